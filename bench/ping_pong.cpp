@@ -0,0 +1,125 @@
+// g++ -std=c++14 -O2 -pthread bench/ping_pong.cpp -o ping_pong && ./ping_pong [round_trips]
+//
+// Measures the SPSC queues and block buffer with two threads:
+//     - ping-pong: a message goes to the other thread and back through a second queue, so every round trip moves
+//       the control fields between the cores twice
+//     - stream: one thread pushes and the other pops, which is where producer and consumer fields on the same cache
+//       line hurt most
+// To compare with the fields packed together, as they were before they were split by owner, build again with
+// -DCACHE_LINE_SIZE=8. Run on a machine with at least two cores.
+
+#include "../spsc_queue.hpp"
+#include "../spsc_ring_queue.hpp"
+#include "../spsc_block_buffer.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <thread>
+
+template <typename FuncT>
+static double elapsed_ns(FuncT fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void report(const char* name, double round_trip_ns, double stream_ns, long n) {
+    std::printf("%-22s ping-pong %8.1f ns/round trip    stream %8.2f Mmsg/s\n", name, round_trip_ns / n,
+                n / stream_ns * 1e3);
+}
+
+template <typename Q>
+static void bench_queue(const char* name, long n) {
+    Q ping, pong;
+    std::thread echo([&] {
+        for (long i = 0; i < n; ++i) {
+            long v = ping.front();
+            ping.pop();
+            pong.push(v);
+        }
+    });
+    double round_trip_ns = elapsed_ns([&] {
+        for (long i = 0; i < n; ++i) {
+            ping.push(i);
+            if (pong.front() != i) {
+                std::abort();
+            }
+            pong.pop();
+        }
+    });
+    echo.join();
+
+    Q q;
+    std::thread consumer([&] {
+        for (long i = 0; i < n; ++i) {
+            if (q.front() != i) {
+                std::abort();
+            }
+            q.pop();
+        }
+    });
+    double stream_ns = elapsed_ns([&] {
+        for (long i = 0; i < n; ++i) {
+            q.push(i);
+        }
+        consumer.join();
+    });
+
+    report(name, round_trip_ns, stream_ns, n);
+}
+
+// SPSCRingQueue::push() fails instead of waiting when the ring is full
+template <size_t capacity>
+class RingAdapter : public SPSCRingQueueSpin<long, capacity> {
+ public:
+    inline void push(long v) {
+        while (!SPSCRingQueueSpin<long, capacity>::push(v));
+    }
+};
+
+static void bench_block_buffer(const char* name, long n) {
+    SPSCBlockBufferSpin ping, pong;
+    ping.init();
+    pong.init();
+    std::thread echo([&] {
+        for (long i = 0; i < n; ++i) {
+            pong.write(ping.get<long>());
+        }
+    });
+    double round_trip_ns = elapsed_ns([&] {
+        for (long i = 0; i < n; ++i) {
+            ping.write(i);
+            if (pong.get<long>() != i) {
+                std::abort();
+            }
+        }
+    });
+    echo.join();
+
+    SPSCBlockBufferSpin buf;
+    buf.init();
+    std::thread consumer([&] {
+        for (long i = 0; i < n; ++i) {
+            if (buf.get<long>() != i) {
+                std::abort();
+            }
+        }
+    });
+    double stream_ns = elapsed_ns([&] {
+        for (long i = 0; i < n; ++i) {
+            buf.write(i);
+        }
+        consumer.join();
+    });
+
+    report(name, round_trip_ns, stream_ns, n);
+}
+
+int main(int argc, char** argv) {
+    long n = argc > 1 ? std::atol(argv[1]) : 1000000;
+    std::printf("CACHE_LINE_SIZE %d, %ld messages\n", CACHE_LINE_SIZE, n);
+    bench_queue<SPSCQueueSpin<long>>("SPSCQueueSpin", n);
+    bench_queue<RingAdapter<1024>>("SPSCRingQueueSpin", n);
+    bench_block_buffer("SPSCBlockBufferSpin", n);
+}
@@ -0,0 +1,270 @@
+/*
+ * BroadcastRing. A fixed-size ring where every reader sees every message from a single producer.
+ * Copyright (C) 2017  Kelvin Ng
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "spsc_queue.hpp"
+#include "wait.hpp"
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+#include <condition_variable>
+
+/*
+ * A fixed-size broadcast ring for single-producer multi-reader setting. A message is written once and read by every
+ * reader through its own cursor. capacity must be a power of two. T must be trivially copyable, since a reader may copy
+ * a slot while it is being overwritten and then detect it. T need not be default-constructible.
+ * policy:
+ *     - 0: wait for the slowest reader. push() fails while the slowest active reader is capacity messages behind
+ *     - 1: overwrite. push() always succeeds. A reader that falls more than capacity behind skips to the oldest
+ *          message still in the ring, and the number of skipped messages is added to its dropped()
+ * mode:
+ *     - 0: wait-free
+ *     - 1: wait by spinning
+ *     - 2: wait by condition variable
+ *     - 6: wait by futex
+ * Only the readers wait.
+ */
+
+// Some guarantees:
+// 1. tail_ only increases. The i-th message is stored in slots_[i & (capacity - 1)]
+// 2. slots_[i & (capacity - 1)].seq == 2 * i + 1 while the i-th message is being written, and 2 * i + 2 after
+// 3. tail_ is written only by the producer, but is read by the readers when they register or fall behind
+// 4. A cursor is written only by its reader, but is read by the producer under policy 0
+// 5. min_cursor_cache_ is read or written only by the producer. It is never ahead of the slowest active cursor
+// 6. cursors_[0, num_readers_) are valid and are never removed until destruction
+
+template <typename T, size_t capacity, int policy, int mode, size_t max_readers = 64>
+class BroadcastRingBase {
+    static_assert(capacity > 0 && (capacity & (capacity - 1)) == 0, "capacity must be a power of two");
+    static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+
+    class Cursor;
+
+ public:
+    // A handle for one reader. Thread-safe for only one reader
+    class Reader {
+     public:
+        // Never wait. Copy the next message to obj
+        // @return: false if there is no new message
+        bool try_read(T& obj) {
+            return ring_->try_read(*cursor_, obj);
+        }
+
+        // Wait according to mode until there is a new message. Copy it to obj
+        // In mode 0, return false if there is no new message
+        bool read(T& obj) {
+            return ring_->wait([&]{return ring_->try_read(*cursor_, obj);});
+        }
+
+        // The number of messages this reader has missed because it fell behind. Always 0 under policy 0
+        inline size_t dropped() const {
+            return cursor_->dropped;
+        }
+
+        // Stop reading. Under policy 0, the producer no longer waits for this reader
+        inline void detach() {
+            __atomic_store_n(&cursor_->active, false, __ATOMIC_RELEASE);
+        }
+
+     private:
+        friend class BroadcastRingBase;
+
+        Reader(BroadcastRingBase* ring, Cursor* cursor) : ring_(ring), cursor_(cursor) {}
+
+        BroadcastRingBase* ring_;
+        Cursor* cursor_;
+    };
+
+    // Not thread-safe
+    BroadcastRingBase() : slots_(new Slot[capacity]), num_readers_(0), tail_(0), min_cursor_cache_(0) {
+        for (size_t i = 0; i < capacity; ++i) {
+            slots_[i].seq = 0;
+        }
+    }
+
+    // Thread-safe
+    // Register a new reader. It receives the messages pushed from now on. At most max_readers readers can be registered
+    // Throw std::length_error if max_readers readers are registered already
+    Reader add_reader() {
+        std::lock_guard<std::mutex> lk(reg_mtx_);
+        if (num_readers_ == max_readers) {
+            throw std::length_error("BroadcastRingBase::add_reader: too many readers");
+        }
+        Cursor& cursor = cursors_[num_readers_];
+        cursor.next = __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+        cursor.dropped = 0;
+        cursor.active = true;
+        __atomic_store_n(&num_readers_, num_readers_ + 1, __ATOMIC_RELEASE);
+        return Reader(this, &cursor);
+    }
+
+    // Thread-safe for only one producer
+    // Under policy 0, return false if the slowest active reader is capacity messages behind. Always true under policy 1
+    bool push(const T& obj) {
+        size_t i = tail_;
+        if (policy == 0 && i - min_cursor_cache_ >= capacity) {
+            min_cursor_cache_ = min_cursor(i);
+            if (i - min_cursor_cache_ >= capacity) {
+                return false;
+            }
+        }
+
+        Slot& slot = slots_[i & (capacity - 1)];
+        __atomic_store_n(&slot.seq, 2 * i + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        std::memcpy(&slot.storage, &obj, sizeof(T));
+
+        if (mode == 2) {
+            std::unique_lock<std::mutex> lk(mtx_);
+            // Atomic is still needed because try_read() does not acquire the lock
+            publish(slot, i);
+            lk.unlock();
+            cv_.notify_all();
+        } else if (mode == 6) {
+            publish(slot, i);
+            futex_.notify_all();
+        } else {
+            publish(slot, i);
+        }
+
+        return true;
+    }
+
+    // Thread-safe for only one producer
+    // The number of messages the slowest active reader is behind, for detecting laggards
+    inline size_t max_lag() {
+        return tail_ - min_cursor(tail_);
+    }
+
+ private:
+    class Slot {
+     public:
+        size_t seq;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+
+    class Cursor {
+     public:
+        alignas(CACHE_LINE_SIZE) size_t next;
+        size_t dropped;
+        bool active;
+    };
+
+    inline void publish(Slot& slot, size_t i) {
+        __atomic_store_n(&slot.seq, 2 * i + 2, __ATOMIC_RELEASE);
+        __atomic_store_n(&tail_, i + 1, __ATOMIC_RELEASE);
+    }
+
+    // Thread-safe for only one producer
+    // @return: the slowest active cursor, or tail if there is none
+    inline size_t min_cursor(size_t tail) {
+        size_t res = tail;
+        size_t num_readers = __atomic_load_n(&num_readers_, __ATOMIC_ACQUIRE);
+        for (size_t k = 0; k < num_readers; ++k) {
+            if (__atomic_load_n(&cursors_[k].active, __ATOMIC_ACQUIRE)) {
+                size_t next = __atomic_load_n(&cursors_[k].next, __ATOMIC_ACQUIRE);
+                if (next < res) {
+                    res = next;
+                }
+            }
+        }
+        return res;
+    }
+
+    // Thread-safe for only the reader of cursor
+    bool try_read(Cursor& cursor, T& obj) {
+        for (;;) {
+            size_t i = cursor.next;
+            Slot& slot = slots_[i & (capacity - 1)];
+            size_t seq = __atomic_load_n(&slot.seq, __ATOMIC_ACQUIRE);
+            if (seq < 2 * i + 2) {
+                // Not yet written
+                return false;
+            }
+            if (seq == 2 * i + 2) {
+                std::memcpy(static_cast<void*>(&obj), &slot.storage, sizeof(T));
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                if (__atomic_load_n(&slot.seq, __ATOMIC_RELAXED) == seq) {
+                    __atomic_store_n(&cursor.next, i + 1, __ATOMIC_RELEASE);
+                    return true;
+                }
+            }
+            // Overwritten by the producer (only possible under policy 1). Skip to the oldest message still in the ring
+            size_t tail = __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+            size_t oldest = tail > capacity ? tail - capacity : 0;
+            if (oldest <= i) {
+                oldest = i + 1;
+            }
+            cursor.dropped += oldest - i;
+            __atomic_store_n(&cursor.next, oldest, __ATOMIC_RELEASE);
+        }
+    }
+
+    // Wait according to mode until pred() is true
+    // @return: the last result of pred()
+    template <typename PredicateT>
+    inline bool wait(PredicateT pred) {
+        if (mode == 2) {
+            if (!pred()) {
+                std::unique_lock<std::mutex> lk(mtx_);
+                cv_.wait(lk, pred);
+            }
+            return true;
+        } else if (mode == 1) {
+            while (!pred());
+            return true;
+        } else if (mode == 6) {
+            futex_.wait(pred);
+            return true;
+        } else {
+            return pred();
+        }
+    }
+
+    std::unique_ptr<Slot[]> slots_;
+
+    // Rarely written
+    Cursor cursors_[max_readers];
+    size_t num_readers_;
+    std::mutex reg_mtx_;
+
+    // Owned by the producer
+    alignas(CACHE_LINE_SIZE) size_t tail_;
+    size_t min_cursor_cache_;
+
+    alignas(CACHE_LINE_SIZE) std::mutex mtx_;
+    std::condition_variable cv_;
+    FutexWaiter futex_;
+};
+
+template <typename T, size_t capacity, int policy = 0>
+using BroadcastRing = BroadcastRingBase<T, capacity, policy, 0>;
+
+template <typename T, size_t capacity, int policy = 0>
+using BroadcastRingSpin = BroadcastRingBase<T, capacity, policy, 1>;
+
+template <typename T, size_t capacity, int policy = 0>
+using BroadcastRingCV = BroadcastRingBase<T, capacity, policy, 2>;
+
+template <typename T, size_t capacity, int policy = 0>
+using BroadcastRingFutex = BroadcastRingBase<T, capacity, policy, 6>;
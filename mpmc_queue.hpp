@@ -0,0 +1,324 @@
+/*
+ * MPMCQueue. A fixed-size queue which allows thread-safe manipulations in a multi-producer multi-consumer setting.
+ * Copyright (C) 2017  Kelvin Ng
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "spsc_queue.hpp"
+#include "wait.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <memory>
+#include <chrono>
+#include <type_traits>
+#include <condition_variable>
+
+/*
+ * A fixed-size queue for multi-consumer and multi-producer setting. Each slot carries a sequence number, so producers
+ * and consumers only contend on the CAS of tail_ and head_ respectively. capacity must be a power of two.
+ * mode:
+ *     - 0: wait-free
+ *     - 1: wait by spinning
+ *     - 2: wait by condition variable
+ *     - 3: wait adaptively. Spin wait_spin_num times with pause, then yield wait_yield_num times, then sleep by futex
+ *     - 6: wait by futex
+ * Only the consumers wait. Pushing never waits and fails when the queue is full.
+ */
+
+// Some guarantees:
+// 1. head_ and tail_ only increase. The i-th element is stored in slots_[i & (capacity - 1)]
+// 2. slots_[i & (capacity - 1)].seq == i when the slot is free for the i-th element
+// 3. slots_[i & (capacity - 1)].seq == i + 1 when the i-th element is published and not yet consumed
+// 4. A producer claims positions [i, i + n) by a CAS of tail_ from i to i + n, after seeing all the n slots free
+// 5. A consumer claims positions [i, i + n) by a CAS of head_ from i to i + n, after seeing all the n slots published,
+//    and frees each slot by setting seq to i + capacity
+// 6. head_ and tail_ are on different cache lines
+
+template <typename T, size_t capacity, int mode, unsigned wait_spin_num = 1024, unsigned wait_yield_num = 16>
+class MPMCQueueBase {
+    static_assert(capacity > 0 && (capacity & (capacity - 1)) == 0, "capacity must be a power of two");
+
+ public:
+    // Not thread-safe
+    MPMCQueueBase() : slots_(new Slot[capacity]), head_(0), tail_(0) {
+        for (size_t i = 0; i < capacity; ++i) {
+            slots_[i].seq = i;
+        }
+    }
+
+    // Not thread-safe
+    ~MPMCQueueBase() {
+        for (; head_ != tail_; ++head_) {
+            slots_[head_ & (capacity - 1)].obj().~T();
+        }
+    }
+
+    // Thread-safe for multiple producers
+    // Return false if the queue is full
+    inline bool push(const T& obj) {
+        return emplace(obj);
+    }
+
+    // Thread-safe for multiple producers
+    // Return false if the queue is full
+    inline bool push(T&& obj) {
+        return emplace(std::move(obj));
+    }
+
+    // Thread-safe for multiple producers
+    // Return false if the queue is full
+    template <typename... Args>
+    bool emplace(Args&&... args) {
+        size_t pos;
+        if (claim(tail_, 0, 1, pos) == 0) {
+            return false;
+        }
+
+        Slot& slot = slots_[pos & (capacity - 1)];
+        new (&slot.obj()) T(std::forward<Args>(args)...);
+        publish([&]{__atomic_store_n(&slot.seq, pos + 1, __ATOMIC_RELEASE);}, false);
+        return true;
+    }
+
+    // Thread-safe for multiple producers
+    // Push as many elements from [first, last) as there are free slots, claiming them with a single CAS
+    // @return: the number of elements pushed
+    template <typename RandomIt>
+    size_t push_range(RandomIt first, RandomIt last) {
+        if (first == last) {
+            return 0;
+        }
+
+        size_t pos;
+        size_t n = claim(tail_, 0, last - first, pos);
+        if (n == 0) {
+            return 0;
+        }
+
+        for (size_t i = 0; i < n; ++i, ++first) {
+            new (&slots_[(pos + i) & (capacity - 1)].obj()) T(*first);
+        }
+        publish([&]{
+            for (size_t i = 0; i < n; ++i) {
+                __atomic_store_n(&slots_[(pos + i) & (capacity - 1)].seq, pos + i + 1, __ATOMIC_RELEASE);
+            }
+        }, n > 1);
+        return n;
+    }
+
+    // Thread-safe for multiple consumers
+    // Never wait. Move the front to obj and pop it
+    // @return: false if the queue is empty
+    inline bool try_pop(T& obj) {
+        return try_pop_n(&obj, 1) == 1;
+    }
+
+    // Thread-safe for multiple consumers
+    // Never wait. Move at most max elements to out and pop them, claiming them with a single CAS
+    // @return: the number of elements popped
+    template <typename OutputIt>
+    size_t try_pop_n(OutputIt out, size_t max) {
+        if (max == 0) {
+            return 0;
+        }
+
+        size_t pos;
+        size_t n = claim(head_, 1, max, pos);
+        for (size_t i = 0; i < n; ++i) {
+            Slot& slot = slots_[(pos + i) & (capacity - 1)];
+            *out = std::move(slot.obj());
+            ++out;
+            slot.obj().~T();
+            __atomic_store_n(&slot.seq, pos + i + capacity, __ATOMIC_RELEASE);
+        }
+        return n;
+    }
+
+    // Thread-safe for multiple consumers
+    // Wait according to mode until an element is claimed. Move it to obj and pop it
+    // In mode 0, return false if the queue is empty
+    inline bool pop(T& obj) {
+        return wait([&]{return try_pop(obj);});
+    }
+
+    // Thread-safe for multiple consumers
+    // Wait according to mode until at least one element is claimed. Move at most max elements to out and pop them
+    // @return: the number of elements popped. Can be 0 only in mode 0
+    template <typename OutputIt>
+    size_t pop_n(OutputIt out, size_t max) {
+        size_t n = 0;
+        wait([&]{return (n = try_pop_n(out, max)) > 0;});
+        return n;
+    }
+
+    // Thread-safe for multiple consumers
+    // Wait until an element is claimed or deadline is reached. Modes that do not block (0, 1) spin with cpu_relax()
+    // @return: false on timeout
+    template <typename Clock, typename Duration>
+    bool pop_until(T& obj, const std::chrono::time_point<Clock, Duration>& deadline) {
+        auto pred = [&]{return try_pop(obj);};
+        if (mode == 2) {
+            for (;;) {
+                if (pred()) {
+                    return true;
+                }
+                std::unique_lock<std::mutex> lk(mtx_);
+                if (!cv_.wait_until(lk, deadline, [&]{return !empty();})) {
+                    return false;
+                }
+            }
+        } else if (mode == 3) {
+            return spin_wait<wait_spin_num, wait_yield_num>(pred) || futex_.wait_until(pred, deadline);
+        } else if (mode == 6) {
+            return futex_.wait_until(pred, deadline);
+        } else {
+            return spin_wait_until(pred, deadline);
+        }
+    }
+
+    // Thread-safe for multiple consumers
+    // Same as pop_until(obj, now + timeout)
+    template <typename Rep, typename Period>
+    inline bool pop_for(T& obj, const std::chrono::duration<Rep, Period>& timeout) {
+        return pop_until(obj, std::chrono::steady_clock::now() + timeout);
+    }
+
+    // Thread-safe
+    // The result may be outdated as soon as it returns
+    inline bool empty() const {
+        size_t pos = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+        return __atomic_load_n(&slots_[pos & (capacity - 1)].seq, __ATOMIC_ACQUIRE) != pos + 1;
+    }
+
+ private:
+    class Slot {
+     public:
+        inline T& obj() {
+            return *reinterpret_cast<T*>(&storage);
+        }
+
+        size_t seq;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+
+    // Claim at most max consecutive positions from idx (head_ or tail_) whose slots have seq == position + offset
+    // @return: the number of positions claimed, starting from pos
+    inline size_t claim(size_t& idx, size_t offset, size_t max, size_t& pos) {
+        if (max > capacity) {
+            max = capacity;
+        }
+
+        pos = __atomic_load_n(&idx, __ATOMIC_RELAXED);
+        for (;;) {
+            size_t n = 0;
+            while (n < max && __atomic_load_n(&slots_[(pos + n) & (capacity - 1)].seq, __ATOMIC_ACQUIRE) == pos + n + offset) {
+                ++n;
+            }
+
+            if (n == 0) {
+                intptr_t diff = (intptr_t)__atomic_load_n(&slots_[pos & (capacity - 1)].seq, __ATOMIC_ACQUIRE) - (intptr_t)(pos + offset);
+                if (diff < 0) {
+                    // Full for producers, empty for consumers
+                    return 0;
+                }
+                // Another thread has claimed pos
+                pos = __atomic_load_n(&idx, __ATOMIC_RELAXED);
+            } else if (__atomic_compare_exchange_n(&idx, &pos, pos + n, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                return n;
+            }
+            // pos is reloaded by the failed CAS
+        }
+    }
+
+    // Run store() to publish, then wake up consumers according to mode
+    template <typename StoreT>
+    inline void publish(StoreT store, bool wake_all) {
+        if (mode == 2) {
+            std::unique_lock<std::mutex> lk(mtx_);
+            // Atomic is still needed because try_pop() does not acquire the lock
+            store();
+            lk.unlock();
+            if (wake_all) {
+                cv_.notify_all();
+            } else {
+                cv_.notify_one();
+            }
+        } else if (mode == 3 || mode == 6) {
+            store();
+            if (wake_all) {
+                futex_.notify_all();
+            } else {
+                futex_.notify();
+            }
+        } else {
+            store();
+        }
+    }
+
+    // Wait according to mode until pred() is true. pred() should claim the elements itself
+    // @return: the last result of pred()
+    template <typename PredicateT>
+    inline bool wait(PredicateT pred) {
+        if (mode == 2) {
+            // Another consumer may win the element after waking up, so wait again if pred() fails
+            while (!pred()) {
+                std::unique_lock<std::mutex> lk(mtx_);
+                cv_.wait(lk, [&]{return !empty();});
+            }
+            return true;
+        } else if (mode == 1) {
+            while (!pred());
+            return true;
+        } else if (mode == 3) {
+            if (!spin_wait<wait_spin_num, wait_yield_num>(pred)) {
+                futex_.wait(pred);
+            }
+            return true;
+        } else if (mode == 6) {
+            futex_.wait(pred);
+            return true;
+        } else {
+            return pred();
+        }
+    }
+
+    std::unique_ptr<Slot[]> slots_;
+
+    // Shared by the consumers
+    alignas(CACHE_LINE_SIZE) size_t head_;
+
+    // Shared by the producers
+    alignas(CACHE_LINE_SIZE) size_t tail_;
+
+    alignas(CACHE_LINE_SIZE) std::mutex mtx_;
+    std::condition_variable cv_;
+    FutexWaiter futex_;
+};
+
+template <typename T, size_t capacity>
+using MPMCQueue = MPMCQueueBase<T, capacity, 0>;
+
+template <typename T, size_t capacity>
+using MPMCQueueSpin = MPMCQueueBase<T, capacity, 1>;
+
+template <typename T, size_t capacity>
+using MPMCQueueCV = MPMCQueueBase<T, capacity, 2>;
+
+template <typename T, size_t capacity>
+using MPMCQueueFutex = MPMCQueueBase<T, capacity, 6>;
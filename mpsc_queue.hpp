@@ -0,0 +1,247 @@
+/*
+ * MPSCQueue. An infinite-size queue which allows thread-safe manipulations in a multi-producer single-consumer setting.
+ * Copyright (C) 2017  Kelvin Ng
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "spsc_queue.hpp"
+#include "wait.hpp"
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <mutex>
+#include <stdexcept>
+#include <condition_variable>
+
+/*
+ * A queue for single-consumer and multi-producer setting. Each producer gets its own SPSCQueue lane from
+ * add_producer(), so producers never contend with each other and nodes are recycled per lane. The consumer visits
+ * the lanes round-robin. Elements from the same producer keep their order. There is no order across producers.
+ * mode:
+ *     - 0: wait-free
+ *     - 1: wait by spinning
+ *     - 2: wait by condition variable. Producers only take the lock while the consumer is sleeping
+ *     - 3: wait adaptively. Spin wait_spin_num times with pause, then yield wait_yield_num times, then sleep by futex
+ *     - 6: wait by futex
+ */
+
+// Some guarantees:
+// 1. lanes_[0, num_lanes_) are valid and are never removed until destruction
+// 2. num_lanes_ is written only under reg_mtx_, but is read by the consumer
+// 3. cur_ is read or written only by the consumer. cur_ < num_lanes_ unless num_lanes_ == 0
+// 4. Each lane is written by exactly one Producer and read only by the consumer
+// 5. waiting_ is written only by the consumer under mtx_, but is read by the producers. In mode 2, a producer takes mtx_
+//    only when waiting_ is set
+
+template <typename T, int mode, size_t max_producers = 64, unsigned wait_spin_num = 1024, unsigned wait_yield_num = 16>
+class MPSCQueueBase {
+    static_assert(mode == 0 || mode == 1 || mode == 2 || mode == 3 || mode == 6, "mode must be 0, 1, 2, 3 or 6");
+
+    typedef SPSCQueueBase<T, 0> Lane;
+
+ public:
+    // A handle for one producer. Thread-safe for only one producer
+    class Producer {
+     public:
+        inline void push(const T& obj) {
+            queue_->publish([&]{lane_->push(obj);});
+        }
+
+        inline void push(T&& obj) {
+            queue_->publish([&]{lane_->push(std::move(obj));});
+        }
+
+        template <typename... Args>
+        inline void emplace(Args&&... args) {
+            queue_->publish([&]{lane_->emplace(std::forward<Args>(args)...);});
+        }
+
+        template <typename InputIt>
+        inline void push_range(InputIt first, InputIt last) {
+            queue_->publish([&]{lane_->push_range(first, last);});
+        }
+
+     private:
+        friend class MPSCQueueBase;
+
+        Producer(MPSCQueueBase* queue, Lane* lane) : queue_(queue), lane_(lane) {}
+
+        MPSCQueueBase* queue_;
+        Lane* lane_;
+    };
+
+    // Not thread-safe
+    MPSCQueueBase() : num_lanes_(0), cur_(0), waiting_(0) {}
+
+    // Not thread-safe
+    ~MPSCQueueBase() {
+        for (size_t i = 0; i < num_lanes_; ++i) {
+            lanes_[i]->~Lane();
+            HeapAllocator().deallocate(lanes_[i], sizeof(Lane), alignof(Lane));
+        }
+    }
+
+    // Thread-safe
+    // Register a new producer. At most max_producers producers can be registered
+    // Throw std::length_error if there are already max_producers producers
+    Producer add_producer() {
+        std::lock_guard<std::mutex> lk(reg_mtx_);
+        if (num_lanes_ == max_producers) {
+            throw std::length_error("MPSCQueueBase::add_producer: too many producers");
+        }
+        // Lane is over-aligned, which plain new does not honour before C++17
+        void* ptr = HeapAllocator().allocate(sizeof(Lane), alignof(Lane));
+        try {
+            lanes_[num_lanes_] = new (ptr) Lane();
+        } catch (...) {
+            HeapAllocator().deallocate(ptr, sizeof(Lane), alignof(Lane));
+            throw;
+        }
+        __atomic_store_n(&num_lanes_, num_lanes_ + 1, __ATOMIC_RELEASE);
+        return Producer(this, lanes_[num_lanes_ - 1]);
+    }
+
+    // Thread-safe for only one consumer
+    void pop() {
+        wait();
+
+        lanes_[cur_]->pop();
+        next_lane();
+    }
+
+    // Thread-safe for only one consumer
+    inline T& front() {
+        wait();
+
+        return lanes_[cur_]->front();
+    }
+
+    // Thread-safe for only one consumer
+    // Never wait. Move the front to obj and pop it
+    // @return: false if the queue is empty
+    bool try_pop(T& obj) {
+        if (empty()) {
+            return false;
+        }
+        lanes_[cur_]->try_pop(obj);
+        next_lane();
+        return true;
+    }
+
+    // Thread-safe for only one consumer
+    // Call fn(T&) on every element available now and pop them, one lane after another. Wait according to mode until
+    // there is at least one element
+    // @return: the number of elements popped
+    template <typename FuncT>
+    size_t consume_all(FuncT fn) {
+        wait();
+
+        size_t num_lanes = __atomic_load_n(&num_lanes_, __ATOMIC_ACQUIRE);
+        size_t n = 0;
+        for (size_t i = 0; i < num_lanes; ++i) {
+            n += lanes_[i]->consume_all(fn);
+        }
+        return n;
+    }
+
+    // Thread-safe for only one consumer
+    // Also moves the consumer to the next non-empty lane
+    inline bool empty() {
+        size_t num_lanes = __atomic_load_n(&num_lanes_, __ATOMIC_ACQUIRE);
+        for (size_t i = 0; i < num_lanes; ++i) {
+            if (!lanes_[cur_]->empty()) {
+                return false;
+            }
+            next_lane(num_lanes);
+        }
+        return true;
+    }
+
+ private:
+    inline void next_lane() {
+        next_lane(__atomic_load_n(&num_lanes_, __ATOMIC_ACQUIRE));
+    }
+
+    inline void next_lane(size_t num_lanes) {
+        cur_ = cur_ + 1 == num_lanes ? 0 : cur_ + 1;
+    }
+
+    // Thread-safe for all producers
+    // Run push() on a lane and wake up the consumer according to mode
+    template <typename PushT>
+    inline void publish(PushT push) {
+        push();
+
+        if (mode == 2) {
+            // Pairs with the fence in wait(). Either the consumer sees the push, or this sees waiting_
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&waiting_, __ATOMIC_RELAXED)) {
+                // Taking the lock orders the push before a consumer that is about to sleep
+                { std::lock_guard<std::mutex> lk(mtx_); }
+                cv_.notify_one();
+            }
+        } else if (mode == 3 || mode == 6) {
+            futex_.notify();
+        }
+    }
+
+    // Thread-safe for only one consumer
+    inline void wait() {
+        if (mode == 2 && empty()) {
+            std::unique_lock<std::mutex> lk(mtx_);
+            __atomic_store_n(&waiting_, 1, __ATOMIC_RELAXED);
+            // Pairs with the fence in publish()
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            cv_.wait(lk, [&]{return !empty();});
+            __atomic_store_n(&waiting_, 0, __ATOMIC_RELAXED);
+        } else if (mode == 1) {
+            while (empty());
+        } else if (mode == 3) {
+            if (!spin_wait<wait_spin_num, wait_yield_num>([&]{return !empty();})) {
+                futex_.wait([&]{return !empty();});
+            }
+        } else if (mode == 6) {
+            futex_.wait([&]{return !empty();});
+        }
+    }
+
+    // Rarely written
+    alignas(CACHE_LINE_SIZE) Lane* lanes_[max_producers];
+    size_t num_lanes_;
+    std::mutex reg_mtx_;
+
+    // Owned by the consumer
+    alignas(CACHE_LINE_SIZE) size_t cur_;
+
+    alignas(CACHE_LINE_SIZE) int waiting_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    FutexWaiter futex_;
+};
+
+template <typename T, size_t max_producers = 64>
+using MPSCQueue = MPSCQueueBase<T, 0, max_producers>;
+
+template <typename T, size_t max_producers = 64>
+using MPSCQueueSpin = MPSCQueueBase<T, 1, max_producers>;
+
+template <typename T, size_t max_producers = 64>
+using MPSCQueueCV = MPSCQueueBase<T, 2, max_producers>;
+
+template <typename T, size_t max_producers = 64>
+using MPSCQueueFutex = MPSCQueueBase<T, 6, max_producers>;
@@ -0,0 +1,233 @@
+/*
+ * Node allocators for the linked queues.
+ * Copyright (C) 2017  Kelvin Ng
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <sys/mman.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+/*
+ * An allocator hands out memory for the nodes of a queue. It needs:
+ *     - void* allocate(size_t size, size_t align)
+ *     - void deallocate(void* ptr, size_t size, size_t align)
+ * A queue only allocates and deallocates from the producer, or when it is not shared, so an allocator does not need to
+ * be thread-safe.
+ */
+
+// Allocate every node by ::operator new. Over-aligned nodes use the aligned ::operator new, or posix_memalign() when it
+// is not available
+class HeapAllocator {
+ public:
+    inline void* allocate(size_t size, size_t align) {
+        if (align <= alignof(std::max_align_t)) {
+            return ::operator new(size);
+        }
+#ifdef __cpp_aligned_new
+        return ::operator new(size, std::align_val_t(align));
+#else
+        void* ptr;
+        if (posix_memalign(&ptr, align, size) != 0) {
+            throw std::bad_alloc();
+        }
+        return ptr;
+#endif
+    }
+
+    inline void deallocate(void* ptr, size_t, size_t align) {
+        if (align <= alignof(std::max_align_t)) {
+            ::operator delete(ptr);
+            return;
+        }
+#ifdef __cpp_aligned_new
+        ::operator delete(ptr, std::align_val_t(align));
+#else
+        free(ptr);
+#endif
+    }
+};
+
+// Map an anonymous chunk. With huge_pages, try MAP_HUGETLB first when size is a multiple of 2MB, and otherwise ask for
+// transparent huge pages
+// Throw std::bad_alloc on failure
+inline void* map_chunk(size_t size, bool huge_pages) {
+    void* ptr = MAP_FAILED;
+    if (huge_pages && size % (2 << 20) == 0) {
+        ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+    if (ptr == MAP_FAILED) {
+        ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+#ifdef MADV_HUGEPAGE
+        if (huge_pages) {
+            madvise(ptr, size, MADV_HUGEPAGE);
+        }
+#endif
+    }
+    return ptr;
+}
+
+inline void unmap_chunk(void* ptr, size_t size) {
+    munmap(ptr, size);
+}
+
+// Carve chunks of chunk_size bytes into slots of the same size. Deallocated slots are kept in a free list and handed
+// out again. Chunks are unmapped only on destruction
+// Every allocation must have the same size and alignment. Throw std::bad_alloc otherwise, or if a slot does not fit in
+// a chunk
+template <size_t chunk_size = (2 << 20), bool huge_pages = false>
+class SlabAllocator {
+ public:
+    SlabAllocator() : chunks_(nullptr), free_(nullptr), next_(nullptr), end_(nullptr), slot_size_(0) {}
+
+    SlabAllocator(const SlabAllocator&) = delete;
+    SlabAllocator& operator=(const SlabAllocator&) = delete;
+
+    SlabAllocator(SlabAllocator&& other) : chunks_(other.chunks_), free_(other.free_), next_(other.next_),
+                                           end_(other.end_), slot_size_(other.slot_size_) {
+        other.chunks_ = nullptr;
+        other.free_ = nullptr;
+        other.next_ = nullptr;
+        other.end_ = nullptr;
+    }
+
+    ~SlabAllocator() {
+        while (chunks_ != nullptr) {
+            Chunk* tmp = chunks_->next;
+            unmap_chunk(chunks_, chunk_size);
+            chunks_ = tmp;
+        }
+    }
+
+    void* allocate(size_t size, size_t align) {
+        if (free_ != nullptr) {
+            FreeSlot* slot = free_;
+            free_ = free_->next;
+            return slot;
+        }
+
+        size_t slot_size = round_up(size < sizeof(FreeSlot) ? sizeof(FreeSlot) : size, align);
+        if (slot_size_ == 0) {
+            if (round_up(sizeof(Chunk), align) + slot_size > chunk_size) {
+                throw std::bad_alloc();
+            }
+            slot_size_ = slot_size;
+        } else if (slot_size != slot_size_) {
+            throw std::bad_alloc();
+        }
+
+        if (next_ == nullptr || static_cast<size_t>(end_ - next_) < slot_size_) {
+            Chunk* chunk = static_cast<Chunk*>(map_chunk(chunk_size, huge_pages));
+            chunk->next = chunks_;
+            chunks_ = chunk;
+            next_ = reinterpret_cast<char*>(chunk) + round_up(sizeof(Chunk), align);
+            end_ = reinterpret_cast<char*>(chunk) + chunk_size;
+        }
+
+        void* ptr = next_;
+        next_ += slot_size_;
+        return ptr;
+    }
+
+    inline void deallocate(void* ptr, size_t, size_t) {
+        FreeSlot* slot = static_cast<FreeSlot*>(ptr);
+        slot->next = free_;
+        free_ = slot;
+    }
+
+ private:
+    class Chunk {
+     public:
+        Chunk* next;
+    };
+
+    class FreeSlot {
+     public:
+        FreeSlot* next;
+    };
+
+    static inline size_t round_up(size_t size, size_t align) {
+        return (size + align - 1) / align * align;
+    }
+
+    Chunk* chunks_;
+    FreeSlot* free_;
+    char* next_;
+    char* end_;
+    size_t slot_size_;
+};
+
+// Hand out memory from chunks of chunk_size bytes by bumping a pointer. deallocate() does nothing, and the memory is
+// returned only when the arena is destroyed. Allocations can have different sizes. Throw std::bad_alloc if one does not
+// fit in a chunk
+template <size_t chunk_size = (2 << 20), bool huge_pages = false>
+class ArenaAllocator {
+ public:
+    ArenaAllocator() : chunks_(nullptr), next_(nullptr), end_(nullptr) {}
+
+    ArenaAllocator(const ArenaAllocator&) = delete;
+    ArenaAllocator& operator=(const ArenaAllocator&) = delete;
+
+    ArenaAllocator(ArenaAllocator&& other) : chunks_(other.chunks_), next_(other.next_), end_(other.end_) {
+        other.chunks_ = nullptr;
+        other.next_ = nullptr;
+        other.end_ = nullptr;
+    }
+
+    ~ArenaAllocator() {
+        while (chunks_ != nullptr) {
+            Chunk* tmp = chunks_->next;
+            unmap_chunk(chunks_, chunk_size);
+            chunks_ = tmp;
+        }
+    }
+
+    void* allocate(size_t size, size_t align) {
+        uintptr_t ptr = (reinterpret_cast<uintptr_t>(next_) + align - 1) / align * align;
+        if (next_ == nullptr || ptr + size > reinterpret_cast<uintptr_t>(end_)) {
+            // Chunks are mapped at page boundaries, so the first allocation in a chunk starts at this offset
+            if ((sizeof(Chunk) + align - 1) / align * align + size > chunk_size) {
+                throw std::bad_alloc();
+            }
+            Chunk* chunk = static_cast<Chunk*>(map_chunk(chunk_size, huge_pages));
+            chunk->next = chunks_;
+            chunks_ = chunk;
+            end_ = reinterpret_cast<char*>(chunk) + chunk_size;
+            ptr = (reinterpret_cast<uintptr_t>(chunk) + sizeof(Chunk) + align - 1) / align * align;
+        }
+        next_ = reinterpret_cast<char*>(ptr + size);
+        return reinterpret_cast<void*>(ptr);
+    }
+
+    inline void deallocate(void*, size_t, size_t) {}
+
+ private:
+    class Chunk {
+     public:
+        Chunk* next;
+    };
+
+    Chunk* chunks_;
+    char* next_;
+    char* end_;
+};
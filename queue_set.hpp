@@ -0,0 +1,291 @@
+/*
+ * QueueSet. A set of SPSC queues which a single consumer waits on and polls at once.
+ * Copyright (C) 2017  Kelvin Ng
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "spsc_queue.hpp"
+#include "wait.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <stdexcept>
+#include <mutex>
+#include <condition_variable>
+
+/*
+ * A set of num_queues SPSC queues with a single consumer. Queue idx has its own producer. A producer marks its queue in
+ * a ready bitmap after pushing, so the consumer finds the non-empty queues by scanning the bitmap instead of polling
+ * every queue. Each poll() visits the ready queues round-robin and takes at most weight elements from each, which is
+ * 1 by default.
+ * mode:
+ *     - 0: wait-free
+ *     - 1: wait by spinning
+ *     - 2: wait by condition variable
+ *     - 3: wait adaptively. Spin wait_spin_num times with pause, then yield wait_yield_num times, then sleep by futex
+ *     - 5: wait-free, and signal get_eventfd() when a queue becomes ready. Consume with drain()
+ *     - 6: wait by futex
+ * The consumer is woken up only when a queue becomes ready, not on every push.
+ */
+
+// Some guarantees:
+// 1. Queue idx is written by its own producer and read only by the consumer
+// 2. A bit in ready_ is set by a producer or the consumer, and cleared only by the consumer
+// 3. If queue idx is non-empty, its bit is set or the consumer is going to visit it in the current poll()
+// 4. A producer wakes up the consumer only when it sets a bit that was clear
+// 5. cur_ and weights_ are read or written only by the consumer
+// 6. In mode 5, producers signal get_eventfd() through EventFdNotify, only when a queue becomes ready while the consumer
+//    is idle
+
+template <typename T, size_t num_queues, int mode, unsigned wait_spin_num = 1024, unsigned wait_yield_num = 16>
+class QueueSetBase : private ModeNotifyPolicy<mode>::type {
+    typedef typename ModeNotifyPolicy<mode>::type NotifyPolicy;
+
+    static_assert(num_queues > 0, "num_queues must be positive");
+    static_assert(mode == 0 || mode == 1 || mode == 2 || mode == 3 || mode == 5 || mode == 6,
+                  "mode must be 0, 1, 2, 3, 5 or 6");
+
+    typedef SPSCQueueBase<T, 0> Queue;
+
+    static constexpr size_t num_words = (num_queues + 63) / 64;
+
+ public:
+    // Not thread-safe
+    QueueSetBase() : cur_(0) {
+        for (size_t i = 0; i < num_words; ++i) {
+            ready_[i] = 0;
+        }
+        for (size_t i = 0; i < num_queues; ++i) {
+            weights_[i] = 1;
+        }
+    }
+
+    // Thread-safe for only the producer of queue idx
+    inline void push(size_t idx, const T& obj) {
+        queues_[idx].push(obj);
+        mark_ready(idx);
+    }
+
+    // Thread-safe for only the producer of queue idx
+    inline void push(size_t idx, T&& obj) {
+        queues_[idx].push(std::move(obj));
+        mark_ready(idx);
+    }
+
+    // Thread-safe for only the producer of queue idx
+    template <typename... Args>
+    inline void emplace(size_t idx, Args&&... args) {
+        queues_[idx].emplace(std::forward<Args>(args)...);
+        mark_ready(idx);
+    }
+
+    // Thread-safe for only the producer of queue idx
+    template <typename InputIt>
+    inline void push_range(size_t idx, InputIt first, InputIt last) {
+        queues_[idx].push_range(first, last);
+        mark_ready(idx);
+    }
+
+    // Thread-safe for only one consumer
+    // poll() takes at most weight elements from queue idx each time
+    // Throw std::invalid_argument if weight is 0, which would leave queue idx ready forever
+    inline void set_weight(size_t idx, unsigned weight) {
+        if (weight == 0) {
+            throw std::invalid_argument("QueueSetBase::set_weight: weight must be positive");
+        }
+        weights_[idx] = weight;
+    }
+
+    // Thread-safe for only one consumer
+    // Wait according to mode until a queue is ready. Then call fn(idx, T&) on the elements of every ready queue and pop
+    // them, at most weight of queue idx from each
+    // @return: the number of elements popped
+    template <typename FuncT>
+    size_t poll(FuncT fn) {
+        wait();
+
+        return consume_ready(fn);
+    }
+
+    // Thread-safe for only one consumer
+    // Same as poll(fn) but never wait
+    template <typename FuncT>
+    inline size_t try_poll(FuncT fn) {
+        return consume_ready(fn);
+    }
+
+    inline int get_eventfd() const {
+        return NotifyPolicy::get_eventfd();
+    }
+
+    // Mode 5 only. Thread-safe for only one consumer
+    // Clear get_eventfd() with a single read(), then poll until no queue is ready after the consumer is marked idle.
+    // The next push() to an empty queue signals get_eventfd() again
+    // @return: the number of elements popped
+    template <typename FuncT>
+    size_t drain(FuncT fn) {
+        NotifyPolicy::clear();
+
+        size_t n = 0;
+        for (;;) {
+            while (!empty()) {
+                n += consume_ready(fn);
+            }
+
+            if (NotifyPolicy::rest([&]{return empty();})) {
+                return n;
+            }
+        }
+    }
+
+    // Thread-safe for only one consumer
+    // May return false when the ready queues have been emptied by the current poll()
+    inline bool empty() const {
+        for (size_t i = 0; i < num_words; ++i) {
+            if (__atomic_load_n(&ready_[i], __ATOMIC_RELAXED) != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+ private:
+    // Thread-safe for only the producer of queue idx
+    // Set the bit of queue idx after a push and wake up the consumer if the bit was clear
+    inline void mark_ready(size_t idx) {
+        uint64_t* word = &ready_[idx / 64];
+        uint64_t bit = uint64_t(1) << (idx % 64);
+
+        // Pairs with the fence in consume_ready(). Either the consumer sees the push, or we see the bit cleared
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(word, __ATOMIC_RELAXED) & bit) {
+            return;
+        }
+        if (__atomic_fetch_or(word, bit, __ATOMIC_RELEASE) & bit) {
+            return;
+        }
+
+        if (mode == 2) {
+            // Taking the lock orders the bit before a consumer that is about to sleep
+            { std::lock_guard<std::mutex> lk(mtx_); }
+            cv_.notify_one();
+        } else if (mode == 3 || mode == 6) {
+            futex_.notify();
+        } else if (mode == 5) {
+            NotifyPolicy::notify();
+        }
+    }
+
+    // Thread-safe for only one consumer
+    inline void wait() {
+        if (mode == 2 && empty()) {
+            std::unique_lock<std::mutex> lk(mtx_);
+            cv_.wait(lk, [&]{return !empty();});
+        } else if (mode == 1) {
+            while (empty());
+        } else if (mode == 3) {
+            if (!spin_wait<wait_spin_num, wait_yield_num>([&]{return !empty();})) {
+                futex_.wait([&]{return !empty();});
+            }
+        } else if (mode == 6) {
+            futex_.wait([&]{return !empty();});
+        }
+    }
+
+    // Thread-safe for only one consumer
+    // Take the ready bitmap and visit the ready queues round-robin from cur_
+    template <typename FuncT>
+    inline size_t consume_ready(FuncT& fn) {
+        uint64_t ready[num_words];
+        for (size_t i = 0; i < num_words; ++i) {
+            ready[i] = __atomic_load_n(&ready_[i], __ATOMIC_RELAXED) ? __atomic_exchange_n(&ready_[i], 0, __ATOMIC_ACQUIRE) : 0;
+        }
+        // Pairs with the fence in mark_ready()
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        size_t start = cur_;
+        size_t n = 0;
+        // The word of start is visited twice, first the bits from start and at last the bits before start
+        for (size_t k = 0; k <= num_words; ++k) {
+            size_t w = (start / 64 + k) % num_words;
+            uint64_t bits = ready[w];
+            if (k == 0) {
+                bits &= ~uint64_t(0) << (start % 64);
+            } else if (k == num_words) {
+                bits &= ~(~uint64_t(0) << (start % 64));
+            }
+            while (bits != 0) {
+                size_t idx = w * 64 + __builtin_ctzll(bits);
+                bits &= bits - 1;
+                n += consume_queue(idx, fn);
+            }
+        }
+
+        cur_ = start + 1 == num_queues ? 0 : start + 1;
+        return n;
+    }
+
+    // Thread-safe for only one consumer
+    // Take at most weights_[idx] elements from queue idx with a single release(). Mark it ready again if it is not empty
+    template <typename FuncT>
+    inline size_t consume_queue(size_t idx, FuncT& fn) {
+        Queue& queue = queues_[idx];
+        typename Queue::View view = queue.peek();
+        size_t n = 0;
+        for (auto it = view.begin(); it != view.end() && n < weights_[idx]; ++it) {
+            fn(idx, *it);
+            ++n;
+        }
+        queue.release(n);
+        if (!queue.empty()) {
+            __atomic_fetch_or(&ready_[idx / 64], uint64_t(1) << (idx % 64), __ATOMIC_RELAXED);
+        }
+        return n;
+    }
+
+    Queue queues_[num_queues];
+
+    // Written by all producers
+    alignas(CACHE_LINE_SIZE) uint64_t ready_[num_words];
+
+    // Owned by the consumer
+    alignas(CACHE_LINE_SIZE) size_t cur_;
+    unsigned weights_[num_queues];
+
+    alignas(CACHE_LINE_SIZE) std::mutex mtx_;
+    std::condition_variable cv_;
+    FutexWaiter futex_;
+};
+
+template <typename T, size_t num_queues>
+using QueueSet = QueueSetBase<T, num_queues, 0>;
+
+template <typename T, size_t num_queues>
+using QueueSetSpin = QueueSetBase<T, num_queues, 1>;
+
+template <typename T, size_t num_queues>
+using QueueSetCV = QueueSetBase<T, num_queues, 2>;
+
+template <typename T, size_t num_queues, unsigned wait_spin_num = 1024, unsigned wait_yield_num = 16>
+using QueueSetAdaptive = QueueSetBase<T, num_queues, 3, wait_spin_num, wait_yield_num>;
+
+template <typename T, size_t num_queues>
+using QueueSetEventFd = QueueSetBase<T, num_queues, 5>;
+
+template <typename T, size_t num_queues>
+using QueueSetFutex = QueueSetBase<T, num_queues, 6>;
@@ -0,0 +1,286 @@
+/*
+ * ShmRegion. A mapping of shared memory for connecting a producer process and a consumer process.
+ * Copyright (C) 2017  Kelvin Ng
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "wait.hpp"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <chrono>
+#include <system_error>
+
+enum class ShmRole {
+    producer = 0,
+    consumer = 1
+};
+
+enum class ShmPeerState {
+    pending,   // Not attached yet
+    alive,
+    detached,  // Detached cleanly
+    dead       // Exited without detaching
+};
+
+/*
+ * Who is attached to one side of a shared memory object, kept in the shared memory. A zero-filled ShmPeer is pending.
+ * A process which exits without release() is seen as dead, so a crashed peer can be detected and replaced. A reused pid
+ * may make a dead peer look alive.
+ */
+
+// Some guarantees:
+// 1. pid_ and detached_ are written only by the process attaching or detaching this side, but are read by the peer
+// 2. pid_ is 0 when nobody is attached
+class ShmPeer {
+ public:
+    // Attach the calling process. Throw std::system_error with EBUSY if a live process is attached
+    void claim() {
+        int pid = getpid();
+        int old = __atomic_load_n(&pid_, __ATOMIC_ACQUIRE);
+        for (;;) {
+            if (old != 0 && alive(old)) {
+                throw std::system_error(EBUSY, std::generic_category(), "ShmPeer::claim");
+            }
+            if (__atomic_compare_exchange_n(&pid_, &old, pid, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+        }
+        __atomic_store_n(&detached_, 0, __ATOMIC_RELEASE);
+    }
+
+    // Detach the calling process
+    void release() {
+        __atomic_store_n(&detached_, 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&pid_, 0, __ATOMIC_RELEASE);
+    }
+
+    ShmPeerState state() const {
+        int pid = __atomic_load_n(&pid_, __ATOMIC_ACQUIRE);
+        if (pid == 0) {
+            return __atomic_load_n(&detached_, __ATOMIC_ACQUIRE) ? ShmPeerState::detached : ShmPeerState::pending;
+        }
+        return alive(pid) ? ShmPeerState::alive : ShmPeerState::dead;
+    }
+
+    // Whether the peer is never coming back without being replaced
+    inline bool gone() const {
+        ShmPeerState s = state();
+        return s == ShmPeerState::detached || s == ShmPeerState::dead;
+    }
+
+ private:
+    static inline bool alive(int pid) {
+        return kill(pid, 0) == 0 || errno == EPERM;
+    }
+
+    int pid_;
+    int detached_;
+};
+
+// Wait according to mode until pred() holds, deadline is reached or peer is gone. Check peer every peer_check_ms
+// milliseconds
+// mode:
+//     - 0: never wait
+//     - 1: wait by spinning
+//     - 6: wait by waiter, which is in the shared memory
+// @return: the last result of pred()
+template <int mode, unsigned peer_check_ms, typename PredicateT, typename Clock, typename Duration>
+bool shm_wait_until(PredicateT pred, SharedFutexWaiter& waiter, const ShmPeer& peer,
+                    const std::chrono::time_point<Clock, Duration>& deadline) {
+    if (pred()) {
+        return true;
+    }
+    if (mode == 0) {
+        return false;
+    }
+    for (;;) {
+        auto check = Clock::now() + std::chrono::milliseconds(peer_check_ms);
+        bool res;
+        if (mode == 6) {
+            res = check < deadline ? waiter.wait_until(pred, check) : waiter.wait_until(pred, deadline);
+        } else {
+            res = check < deadline ? spin_wait_until(pred, check) : spin_wait_until(pred, deadline);
+        }
+        if (res) {
+            return true;
+        }
+        if (Clock::now() >= deadline || peer.gone()) {
+            return pred();
+        }
+    }
+}
+
+/*
+ * A read-write mapping of a shared memory object, either named with shm_open() or anonymous with memfd_create(). The
+ * fd of an anonymous object can be passed to the other process through fork() or SCM_RIGHTS, and attached there.
+ * Newly created memory is zero-filled. Errors are thrown as std::system_error. Move-only.
+ */
+class ShmRegion {
+ public:
+    ShmRegion() : data_(nullptr), size_(0), fd_(-1) {}
+
+    ShmRegion(ShmRegion&& other) : data_(other.data_), size_(other.size_), fd_(other.fd_) {
+        other.data_ = nullptr;
+        other.size_ = 0;
+        other.fd_ = -1;
+    }
+
+    ShmRegion& operator=(ShmRegion&& other) {
+        if (this != &other) {
+            reset();
+            data_ = other.data_;
+            size_ = other.size_;
+            fd_ = other.fd_;
+            other.data_ = nullptr;
+            other.size_ = 0;
+            other.fd_ = -1;
+        }
+        return *this;
+    }
+
+    ShmRegion(const ShmRegion&) = delete;
+    ShmRegion& operator=(const ShmRegion&) = delete;
+
+    ~ShmRegion() {
+        reset();
+    }
+
+    // Create the shared memory object name of size bytes. Fail with EEXIST if it exists
+    static ShmRegion create(const char* name, size_t size) {
+        int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd == -1) {
+            throw std::system_error(errno, std::generic_category(), "shm_open");
+        }
+        ShmRegion region;
+        try {
+            region.map(fd, size, true);
+        } catch (...) {
+            shm_unlink(name);
+            throw;
+        }
+        return region;
+    }
+
+    // Create an anonymous shared memory object of size bytes
+    static ShmRegion create(size_t size) {
+        int fd = memfd_create("ShmRegion", MFD_CLOEXEC);
+        if (fd == -1) {
+            throw std::system_error(errno, std::generic_category(), "memfd_create");
+        }
+        ShmRegion region;
+        region.map(fd, size, true);
+        return region;
+    }
+
+    // Map the whole shared memory object name. Fail with EAGAIN if it has size 0, e.g. when the creator has not sized it
+    // yet
+    static ShmRegion attach(const char* name) {
+        int fd = shm_open(name, O_RDWR, 0);
+        if (fd == -1) {
+            throw std::system_error(errno, std::generic_category(), "shm_open");
+        }
+        ShmRegion region;
+        region.map(fd, 0, false);
+        return region;
+    }
+
+    // Map the whole shared memory object of fd. fd is not taken over. Fail with EAGAIN if it has size 0
+    static ShmRegion attach(int fd) {
+        int dup_fd = dup(fd);
+        if (dup_fd == -1) {
+            throw std::system_error(errno, std::generic_category(), "dup");
+        }
+        ShmRegion region;
+        region.map(dup_fd, 0, false);
+        return region;
+    }
+
+    // Remove name. Processes which have it attached are not affected
+    static inline void unlink(const char* name) {
+        shm_unlink(name);
+    }
+
+    inline char* data() const {
+        return data_;
+    }
+
+    inline size_t size() const {
+        return size_;
+    }
+
+    // The fd of the shared memory object. It stays open until the region is destroyed
+    inline int fd() const {
+        return fd_;
+    }
+
+ private:
+    // Take over fd. It is closed on failure
+    void map(int fd, size_t size, bool truncate) {
+        if (truncate) {
+            if (ftruncate(fd, size) == -1) {
+                int err = errno;
+                close(fd);
+                throw std::system_error(err, std::generic_category(), "ftruncate");
+            }
+        } else {
+            struct stat st;
+            if (fstat(fd, &st) == -1) {
+                int err = errno;
+                close(fd);
+                throw std::system_error(err, std::generic_category(), "fstat");
+            }
+            // The creator has opened the object but not sized it yet
+            if (st.st_size == 0) {
+                close(fd);
+                throw std::system_error(EAGAIN, std::generic_category(), "ShmRegion::attach");
+            }
+            size = st.st_size;
+        }
+        void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            int err = errno;
+            close(fd);
+            throw std::system_error(err, std::generic_category(), "mmap");
+        }
+        data_ = static_cast<char*>(data);
+        size_ = size;
+        fd_ = fd;
+    }
+
+    void reset() {
+        if (data_ != nullptr) {
+            munmap(data_, size_);
+            data_ = nullptr;
+            size_ = 0;
+        }
+        if (fd_ != -1) {
+            close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    char* data_;
+    size_t size_;
+    int fd_;
+};
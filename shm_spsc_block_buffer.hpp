@@ -0,0 +1,734 @@
+/*
+ * ShmSPSCBlockBuffer. A fixed-size buffer in shared memory which connects a producer process and a consumer process.
+ * Copyright (C) 2017  Kelvin Ng
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "shm_region.hpp"
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <new>
+#include <queue>
+#include <string>
+#include <utility>
+#include <algorithm>
+#include <system_error>
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+/*
+ * SPSCBlockBufferBase laid out in a shared memory object, for a producer process and a consumer process. Each process
+ * holds its own ShmSPSCBlockBufferBase, made by create() or attach() with its ShmRole. The blocks come from a pool of
+ * num_blocks blocks in the shared memory. The producer hands them to the consumer through a ring of descriptors, and
+ * the consumer gives them back through a ring of free blocks after clear_preserved(). Data is read in place.
+ * mode decides what happens when the producer needs a new block but all of them are in use, or when the consumer needs
+ * more data:
+ *     - 0: fail. write() and write_cont() write nothing and return false, ensure_cont() returns nullptr, and
+ *          input_from_fd() stops, returning -1 with errno ENOBUFS if nothing is read. read() and read_cont() return
+ *          nullptr
+ *     - 1: wait by spinning
+ *     - 6: wait by futex, shared between the processes. The notifier only pays a fence and a load when nobody sleeps
+ * A waiting side checks every peer_check_ms milliseconds whether the peer is gone (see ShmPeer). Then the producer
+ * fails as in mode 0, possibly after writing part of the data, and the consumer fails once the data is used up.
+ * A crashed side can be replaced by attaching again with its role. A new producer continues after the data published
+ * by notify(). A new consumer starts from the beginning of the block being read, and the blocks kept for
+ * clear_preserved() by the crashed consumer are lost.
+ */
+
+// Some guarantees:
+//  1. Thread-safe with single-consumer and single-producer, which can be in different processes
+//  2. The descriptors in [head, tail) are the blocks being written or read. There is always at least one
+//  3. The producer writes to the block of descriptor tail - 1, and the consumer reads from the block of descriptor head
+//  4. The size of a descriptor is written only by the producer, but is read by both sides. It is final once the
+//     descriptor is not the last one
+//  5. The blocks in free ring entries [free_head, free_tail) are free. Every block is either free, in a descriptor,
+//     kept for clear_preserved() or being taken, so each ring has room for all blocks
+//  6. head and free_tail are written only by the consumer, but are read by both sides
+//  7. tail and free_head are written only by the producer, but are read by both sides
+//  8. Memory is never moved. Data is always valid until explicitly removed with clear_preserved()
+//  9. head_, rpos_, one_block_left_, free_tail_, cleared_ and preserved_list_ are read or written only by the consumer
+// 10. When one_block_left_ is false, there must be more than one block. No guarantee when one_block_left_ is true
+// 11. tail_, back_, wpos_private_, free_head_ and free_tail_cache_ are read or written only by the producer.
+//     free_tail_cache_ is a possibly outdated free_tail
+// 12. The fields owned by the producer and the consumer are on different cache lines of the shared memory
+
+template <int mode, unsigned peer_check_ms = 100>
+class ShmSPSCBlockBufferBase {
+    static_assert(mode == 0 || mode == 1 || mode == 6, "mode must be 0, 1 or 6");
+
+ public:
+    ShmSPSCBlockBufferBase()
+        : shared_(nullptr), role_(ShmRole::producer), block_size_(0), num_blocks_(0), descs_(nullptr),
+          free_ring_(nullptr), blocks_(nullptr), head_(0), rpos_(0), one_block_left_(true), free_tail_(0), cleared_(0),
+          tail_(0), back_(nullptr), wpos_private_(0), free_head_(0), free_tail_cache_(0) {}
+
+    ShmSPSCBlockBufferBase(ShmSPSCBlockBufferBase&& other) : ShmSPSCBlockBufferBase() {
+        *this = std::move(other);
+    }
+
+    ShmSPSCBlockBufferBase& operator=(ShmSPSCBlockBufferBase&& other) {
+        if (this != &other) {
+            detach();
+            region_ = std::move(other.region_);
+            shared_ = other.shared_;
+            role_ = other.role_;
+            block_size_ = other.block_size_;
+            num_blocks_ = other.num_blocks_;
+            descs_ = other.descs_;
+            free_ring_ = other.free_ring_;
+            blocks_ = other.blocks_;
+            head_ = other.head_;
+            rpos_ = other.rpos_;
+            one_block_left_ = other.one_block_left_;
+            free_tail_ = other.free_tail_;
+            cleared_ = other.cleared_;
+            preserved_list_ = std::move(other.preserved_list_);
+            tail_ = other.tail_;
+            back_ = other.back_;
+            wpos_private_ = other.wpos_private_;
+            free_head_ = other.free_head_;
+            free_tail_cache_ = other.free_tail_cache_;
+            other.shared_ = nullptr;
+        }
+        return *this;
+    }
+
+    ~ShmSPSCBlockBufferBase() {
+        detach();
+    }
+
+    // Create the shared memory object name with num_blocks blocks of block_size bytes, and attach as role
+    static ShmSPSCBlockBufferBase create(const char* name, size_t block_size, size_t num_blocks, ShmRole role) {
+        check_size(block_size, num_blocks);
+        ShmSPSCBlockBufferBase b;
+        b.region_ = ShmRegion::create(name, region_size(block_size, num_blocks));
+        b.init(block_size, num_blocks);
+        b.open(role);
+        return b;
+    }
+
+    // Create an anonymous buffer with num_blocks blocks of block_size bytes, and attach as role. Pass fd() to the
+    // other process
+    static ShmSPSCBlockBufferBase create(size_t block_size, size_t num_blocks, ShmRole role) {
+        check_size(block_size, num_blocks);
+        ShmSPSCBlockBufferBase b;
+        b.region_ = ShmRegion::create(region_size(block_size, num_blocks));
+        b.init(block_size, num_blocks);
+        b.open(role);
+        return b;
+    }
+
+    // Attach to the buffer in the shared memory object name as role
+    // Throw std::system_error with EAGAIN if it is not initialized yet, EINVAL if it is not a buffer, and EBUSY if a
+    // live process is attached as role
+    static ShmSPSCBlockBufferBase attach(const char* name, ShmRole role) {
+        ShmSPSCBlockBufferBase b;
+        b.region_ = ShmRegion::attach(name);
+        b.open(role);
+        return b;
+    }
+
+    // Same as attach(name, role), with the fd of the shared memory object. fd is not taken over
+    static ShmSPSCBlockBufferBase attach(int fd, ShmRole role) {
+        ShmSPSCBlockBufferBase b;
+        b.region_ = ShmRegion::attach(fd);
+        b.open(role);
+        return b;
+    }
+
+    // Detach and unmap, so that the peer sees this side as detached. Called by the destructor
+    void detach() {
+        if (shared_ != nullptr) {
+            shared_->peers[static_cast<int>(role_)].release();
+            shared_ = nullptr;
+            region_ = ShmRegion();
+        }
+    }
+
+    inline int fd() const {
+        return region_.fd();
+    }
+
+    inline size_t block_size() const {
+        return block_size_;
+    }
+
+    inline ShmPeerState peer_state() const {
+        return peer().state();
+    }
+
+    // For producer only
+    // write [write_start, write_end) to the buffer
+    // @return: false if nothing is written because all blocks are in use in mode 0, or if the consumer is gone
+    bool write(const char* write_start, const char* write_end, bool notify = true) {
+        if (mode == 0) {
+            size_t len = write_start < write_end ? write_end - write_start : 0;
+            size_t left = block_size_ - wpos_private_;
+            if (len > left && !has_free_blocks((len - left + block_size_ - 1) / block_size_)) {
+                return false;
+            }
+        }
+
+        while (write_start < write_end) {
+            if (!add_block_if_needed()) {
+                return false;
+            }
+
+            size_t to_write = std::min((size_t)(write_end - write_start), block_size_ - wpos_private_);
+            std::memcpy(block(back_->block) + wpos_private_, write_start, to_write);
+            write_start += to_write;
+            wpos_private_ += to_write;
+        }
+
+        if (notify) {
+            this->notify();
+        }
+        return true;
+    }
+
+    // For producer only
+    template <typename T>
+    inline bool write(const T& ptr, bool notify = true) {
+        return write((const char*)&ptr, (const char*)(&ptr + 1), notify);
+    }
+
+    // For producer only
+    bool write(const std::string& str, bool notify = true) {
+        size_t size = str.size();
+        if (mode == 0) {
+            size_t len = sizeof(size) + size;
+            size_t left = block_size_ - wpos_private_;
+            if (len > left && !has_free_blocks((len - left + block_size_ - 1) / block_size_)) {
+                return false;
+            }
+        }
+        return write(size, false) && write(str.c_str(), str.c_str() + size, notify);
+    }
+
+    // For producer only
+    // write [write_start, write_end) to the buffer within one block
+    // @return: false if nothing is written because all blocks are in use in mode 0, or if the consumer is gone
+    bool write_cont(const char* write_start, const char* write_end, bool notify = true) {
+        if (write_start >= write_end) {
+            return true;
+        }
+
+        size_t to_write = write_end - write_start;
+        if (!add_block_if_needed(to_write)) {
+            return false;
+        }
+
+        std::memcpy(block(back_->block) + wpos_private_, write_start, to_write);
+
+        wpos_private_ += to_write;
+
+        if (notify) {
+            this->notify();
+        }
+        return true;
+    }
+
+    // For producer only
+    template <typename T>
+    inline bool write_cont(const T& ptr, bool notify = true) {
+        return write_cont((const char*)&ptr, (const char*)&ptr + sizeof(T), notify);
+    }
+
+    // For producer only
+    bool write_cont(const std::string& str, bool notify = true) {
+        size_t size = str.size();
+        if (mode == 0) {
+            // The string needs a new block, and so does the length if it does not fit in the current block. Both share
+            // the new block when they fit in it
+            size_t left = block_size_ - wpos_private_;
+            if (sizeof(size) + size > left &&
+                    !has_free_blocks(sizeof(size) <= left || sizeof(size) + size <= block_size_ ? 1 : 2)) {
+                return false;
+            }
+        }
+        // An empty string writes only the length, which must then be notified
+        return write_cont(size, notify && size == 0) && write_cont(str.c_str(), str.c_str() + size, notify);
+    }
+
+    // For producer only
+    inline ssize_t input_from_fd(int fd, bool cont = false, ssize_t max_len = -1) {
+        ssize_t total_len = 0;
+
+        for (;;) {
+            if (!add_block_if_needed()) {
+                if (total_len == 0) {
+                    errno = ENOBUFS;
+                    return -1;
+                }
+                break;
+            }
+
+            ssize_t len;
+            if (max_len == -1) {
+                len = ::read(fd, block(back_->block) + wpos_private_, block_size_ - wpos_private_);
+            } else {
+                len = ::read(fd, block(back_->block) + wpos_private_, std::min((size_t)(max_len - total_len), block_size_ - wpos_private_));
+            }
+            if (len < 0) {
+                if (total_len == 0) {
+                    return len;
+                } else {
+                    break;
+                }
+            } else if (len == 0) {
+                break;
+            }
+            total_len += len;
+            wpos_private_ += len;
+
+            if (cont) {
+                break;
+            }
+        }
+
+        if (total_len > 0) {
+            this->notify();
+        }
+
+        return total_len;
+    }
+
+    // For producer only
+    // Make everything written visible to the consumer
+    void notify() {
+        __atomic_store_n(&back_->size, wpos_private_, __ATOMIC_RELEASE);
+        if (mode == 6) {
+            shared_->data.notify();
+        }
+    }
+
+    // For producer only
+    // @return: nullptr if there is no room because all blocks are in use in mode 0, or if the consumer is gone
+    inline char* ensure_cont(size_t size) {
+        if (!add_block_if_needed(size)) {
+            return nullptr;
+        }
+        return block(back_->block) + wpos_private_;
+    }
+
+    // For consumer only
+    // @return: nullptr if there is not enough data in mode 0, or if the data is used up and the producer is gone
+    template <typename T>
+    inline const T* read() {
+        return static_cast<const T*>(read_cont(sizeof(T)));
+    }
+
+    // For consumer only
+    // @return: false if there is not enough data in mode 0, or if the data is used up and the producer is gone
+    template <typename T>
+    bool get(T& obj) {
+        const T* res = read<T>();
+        if (res == nullptr) {
+            return false;
+        }
+        // The stream gives no alignment
+        std::memcpy(&obj, res, sizeof(T));
+        clear_preserved(sizeof(T));
+        return true;
+    }
+
+    // For consumer only
+    // @return: nullptr if there is not enough data in mode 0, or if the data is used up and the producer is gone
+    const void* read_cont(size_t len) {
+        if (!shm_wait_until<mode, peer_check_ms>([&]{return readable(len);}, shared_->data, peer(),
+                                                 std::chrono::steady_clock::time_point::max())) {
+            return nullptr;
+        }
+
+        const void* res = block(front().block) + rpos_;
+        rpos_ += len;
+        return res;
+    }
+
+    // For consumer only
+    // @return: false if there is not enough data in mode 0, or if the data is used up and the producer is gone
+    bool get_cont(char* dest, size_t len) {
+        const void* res = read_cont(len);
+        if (res == nullptr) {
+            return false;
+        }
+        std::memcpy(dest, res, len);
+        clear_preserved(len);
+        return true;
+    }
+
+    // For consumer only
+    // Read a string written by write_cont()
+    // @return: false if there is not enough data in mode 0, or if the data is used up and the producer is gone. Nothing
+    //          is read then, so the string can be read again later
+    bool get_string(std::string& str) {
+        size_t len;
+        bool same_block;
+        if (!shm_wait_until<mode, peer_check_ms>([&]{return string_readable(len, same_block);}, shared_->data, peer(),
+                                                 std::chrono::steady_clock::time_point::max())) {
+            return false;
+        }
+
+        rpos_ += sizeof(size_t);
+        if (!same_block) {
+            pop_block();
+        }
+        str.assign(block(front().block) + rpos_, len);
+        rpos_ += len;
+        clear_preserved(sizeof(size_t) + len);
+        return true;
+    }
+
+    // For consumer only
+    // Non-blocking
+    inline ssize_t output_to_fd(int fd) {
+        ssize_t total_len = 0;
+
+        for (;;) {
+            pop_block_if_read();
+
+            size_t to_write;
+            if (one_block_left_) {
+                to_write = __atomic_load_n(&front().size, __ATOMIC_ACQUIRE) - rpos_;
+            } else {
+                to_write = front().size - rpos_;
+            }
+            if (to_write == 0) {
+                break;
+            }
+
+            ssize_t len = ::write(fd, block(front().block) + rpos_, to_write);
+            if (len < 0) {
+                if (total_len == 0) {
+                    return len;
+                } else {
+                    break;
+                }
+            } else if (len == 0) {
+                break;
+            }
+            rpos_ += len;
+            total_len += len;
+        }
+
+        clear_preserved(total_len);
+
+        return total_len;
+    }
+
+    // For consumer only
+    inline bool empty() {
+        return one_block_left_ && (one_block_left_ = check_one_block_left()) &&
+            rpos_ == __atomic_load_n(&front().size, __ATOMIC_ACQUIRE);
+    }
+
+    // For consumer only
+    // Give back the blocks which are read completely, once len bytes more are done with. Unlike SPSCBlockBufferBase,
+    // len adds up across calls, so clearing what is read piece by piece gives back every block
+    inline void clear_preserved(size_t len) {
+        cleared_ += len;
+        size_t num_freed = 0;
+        while (!preserved_list_.empty() && preserved_list_.front().second <= cleared_) {
+            cleared_ -= preserved_list_.front().second;
+            free_ring_[free_tail_ % num_blocks_] = preserved_list_.front().first;
+            ++free_tail_;
+            preserved_list_.pop();
+            ++num_freed;
+        }
+
+        if (num_freed > 0) {
+            __atomic_store_n(&shared_->free_tail, free_tail_, __ATOMIC_RELEASE);
+            if (mode == 6) {
+                shared_->room.notify();
+            }
+        }
+    }
+
+ private:
+    static constexpr uint64_t shm_magic = 0x5350534342554646ULL;
+
+    struct Desc {
+        uint64_t block;
+        size_t size;
+    };
+
+    struct Shared {
+        uint64_t magic;
+        uint64_t block_size;
+        uint64_t num_blocks;
+        ShmPeer peers[2];
+
+        // Owned by the consumer
+        alignas(CACHE_LINE_SIZE) uint64_t head;
+        uint64_t free_tail;
+
+        // Owned by the producer
+        alignas(CACHE_LINE_SIZE) uint64_t tail;
+        uint64_t free_head;
+
+        // The consumer waits for data, and the producer waits for free blocks
+        alignas(CACHE_LINE_SIZE) SharedFutexWaiter data;
+        alignas(CACHE_LINE_SIZE) SharedFutexWaiter room;
+    };
+
+    static inline void check_size(size_t block_size, size_t num_blocks) {
+        if (block_size == 0 || num_blocks < 2) {
+            throw std::system_error(EINVAL, std::generic_category(), "ShmSPSCBlockBufferBase::create");
+        }
+    }
+
+    static inline size_t descs_offset() {
+        return sizeof(Shared);
+    }
+
+    static inline size_t free_ring_offset(size_t num_blocks) {
+        return descs_offset() + num_blocks * sizeof(Desc);
+    }
+
+    static inline size_t blocks_offset(size_t num_blocks) {
+        size_t end = free_ring_offset(num_blocks) + num_blocks * sizeof(uint64_t);
+        return (end + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+    }
+
+    static inline size_t region_size(size_t block_size, size_t num_blocks) {
+        return blocks_offset(num_blocks) + num_blocks * block_size;
+    }
+
+    inline char* block(uint64_t idx) const {
+        return blocks_ + idx * block_size_;
+    }
+
+    inline Desc& front() const {
+        return descs_[head_ % num_blocks_];
+    }
+
+    inline const ShmPeer& peer() const {
+        return shared_->peers[role_ == ShmRole::producer ? 1 : 0];
+    }
+
+    // Lay out the buffer in newly created memory. Block 0 is being written, and the others are free
+    void init(size_t block_size, size_t num_blocks) {
+        Shared* shared = new (region_.data()) Shared();
+        shared->block_size = block_size;
+        shared->num_blocks = num_blocks;
+
+        Desc* descs = reinterpret_cast<Desc*>(region_.data() + descs_offset());
+        uint64_t* free_ring = reinterpret_cast<uint64_t*>(region_.data() + free_ring_offset(num_blocks));
+        descs[0].block = 0;
+        descs[0].size = 0;
+        for (size_t i = 1; i < num_blocks; ++i) {
+            free_ring[i - 1] = i;
+        }
+        shared->head = 0;
+        shared->tail = 1;
+        shared->free_head = 0;
+        shared->free_tail = num_blocks - 1;
+
+        // Published last, so that a process attaching by name never sees a half-initialized buffer
+        __atomic_store_n(&shared->magic, shm_magic, __ATOMIC_RELEASE);
+    }
+
+    // Check the buffer and attach as role
+    void open(ShmRole role) {
+        if (region_.size() < sizeof(Shared)) {
+            throw std::system_error(EAGAIN, std::generic_category(), "ShmSPSCBlockBufferBase::open");
+        }
+        Shared* shared = reinterpret_cast<Shared*>(region_.data());
+        uint64_t m = __atomic_load_n(&shared->magic, __ATOMIC_ACQUIRE);
+        if (m == 0) {
+            throw std::system_error(EAGAIN, std::generic_category(), "ShmSPSCBlockBufferBase::open");
+        }
+        if (m != shm_magic || shared->num_blocks < 2 ||
+                region_.size() < region_size(shared->block_size, shared->num_blocks)) {
+            throw std::system_error(EINVAL, std::generic_category(), "ShmSPSCBlockBufferBase::open");
+        }
+
+        shared->peers[static_cast<int>(role)].claim();
+        shared_ = shared;
+        role_ = role;
+        block_size_ = shared->block_size;
+        num_blocks_ = shared->num_blocks;
+        descs_ = reinterpret_cast<Desc*>(region_.data() + descs_offset());
+        free_ring_ = reinterpret_cast<uint64_t*>(region_.data() + free_ring_offset(num_blocks_));
+        blocks_ = region_.data() + blocks_offset(num_blocks_);
+        if (role == ShmRole::consumer) {
+            head_ = __atomic_load_n(&shared->head, __ATOMIC_ACQUIRE);
+            rpos_ = 0;
+            one_block_left_ = true;
+            free_tail_ = __atomic_load_n(&shared->free_tail, __ATOMIC_ACQUIRE);
+        } else {
+            tail_ = __atomic_load_n(&shared->tail, __ATOMIC_ACQUIRE);
+            back_ = &descs_[(tail_ - 1) % num_blocks_];
+            wpos_private_ = __atomic_load_n(&back_->size, __ATOMIC_ACQUIRE);
+            free_head_ = __atomic_load_n(&shared->free_head, __ATOMIC_ACQUIRE);
+            free_tail_cache_ = free_head_;
+        }
+    }
+
+    // For producer only
+    inline bool has_free_blocks(size_t num) {
+        if (free_tail_cache_ - free_head_ >= num) {
+            return true;
+        }
+        free_tail_cache_ = __atomic_load_n(&shared_->free_tail, __ATOMIC_ACQUIRE);
+        return free_tail_cache_ - free_head_ >= num;
+    }
+
+    // For producer only
+    // Wait according to mode until there is a free block
+    // @return: false if there is none in mode 0, or if the consumer is gone
+    inline bool reserve_block() {
+        if (has_free_blocks(1)) {
+            return true;
+        }
+        if (mode == 0) {
+            return false;
+        }
+        // The consumer can only give back blocks that it has seen
+        notify();
+        return shm_wait_until<mode, peer_check_ms>([&]{return has_free_blocks(1);}, shared_->room, peer(),
+                                                   std::chrono::steady_clock::time_point::max());
+    }
+
+    // For producer only. There must be a free block
+    void add_block() {
+        __atomic_store_n(&back_->size, wpos_private_, __ATOMIC_RELEASE);
+        wpos_private_ = 0;
+
+        uint64_t idx = free_ring_[free_head_ % num_blocks_];
+        ++free_head_;
+        back_ = &descs_[tail_ % num_blocks_];
+        back_->block = idx;
+        __atomic_store_n(&back_->size, 0, __ATOMIC_RELAXED);
+        ++tail_;
+        __atomic_store_n(&shared_->free_head, free_head_, __ATOMIC_RELAXED);
+        __atomic_store_n(&shared_->tail, tail_, __ATOMIC_RELEASE);
+    }
+
+    // @return: false if the block cannot be added
+    inline bool add_block_if_needed() {
+        if (wpos_private_ == block_size_) {
+            if (!reserve_block()) {
+                return false;
+            }
+            add_block();
+        }
+        return true;
+    }
+
+    // @return: false if the block cannot be added
+    inline bool add_block_if_needed(size_t cont_write_len) {
+        if (cont_write_len > block_size_ - wpos_private_) {
+            if (!reserve_block()) {
+                return false;
+            }
+            add_block();
+        }
+        return true;
+    }
+
+    // For consumer only
+    inline bool check_one_block_left() const {
+        return __atomic_load_n(&shared_->tail, __ATOMIC_ACQUIRE) == head_ + 1;
+    }
+
+    // For consumer only
+    // Keep the front block for clear_preserved() with the number of bytes read from it
+    void pop_block() {
+        preserved_list_.emplace(front().block, rpos_);
+        ++head_;
+        __atomic_store_n(&shared_->head, head_, __ATOMIC_RELAXED);
+        rpos_ = 0;
+        one_block_left_ = check_one_block_left();
+    }
+
+    // For consumer only
+    // Whether len bytes can be read in one block. Skip to the next block when they are not in the current one
+    inline bool readable(size_t len) {
+        for (;;) {
+            if (one_block_left_ && (one_block_left_ = check_one_block_left())) {
+                return __atomic_load_n(&front().size, __ATOMIC_ACQUIRE) - rpos_ >= len;
+            }
+            // No need atomic because there is more than one block
+            if (front().size - rpos_ >= len) {
+                return true;
+            }
+            pop_block();
+        }
+    }
+
+    // For consumer only
+    // Whether both the length and the bytes of a string written by write_cont() can be read, without reading them. The
+    // bytes are in the next block when they do not fit after the length
+    inline bool string_readable(size_t& len, bool& same_block) {
+        if (!readable(sizeof(size_t))) {
+            return false;
+        }
+        std::memcpy(&len, block(front().block) + rpos_, sizeof(len));
+        same_block = len <= block_size_ - rpos_ - sizeof(size_t);
+        if (same_block) {
+            return __atomic_load_n(&front().size, __ATOMIC_ACQUIRE) - rpos_ >= sizeof(size_t) + len;
+        }
+        return __atomic_load_n(&shared_->tail, __ATOMIC_ACQUIRE) > head_ + 1 &&
+            __atomic_load_n(&descs_[(head_ + 1) % num_blocks_].size, __ATOMIC_ACQUIRE) >= len;
+    }
+
+    // For consumer only
+    inline void pop_block_if_read() {
+        if ((!one_block_left_ || !(one_block_left_ = check_one_block_left())) && front().size == rpos_) {
+            pop_block();
+        }
+    }
+
+    ShmRegion region_;
+    Shared* shared_;
+    ShmRole role_;
+
+    // Rarely written
+    size_t block_size_;
+    size_t num_blocks_;
+    Desc* descs_;
+    uint64_t* free_ring_;
+    char* blocks_;
+
+    // Owned by the consumer
+    uint64_t head_;
+    size_t rpos_;
+    bool one_block_left_;
+    uint64_t free_tail_;
+    size_t cleared_;
+    std::queue<std::pair<uint64_t, size_t>> preserved_list_;
+
+    // Owned by the producer
+    uint64_t tail_;
+    Desc* back_;
+    size_t wpos_private_;
+    uint64_t free_head_;
+    uint64_t free_tail_cache_;
+};
+
+using ShmSPSCBlockBuffer = ShmSPSCBlockBufferBase<0>;
+using ShmSPSCBlockBufferSpin = ShmSPSCBlockBufferBase<1>;
+using ShmSPSCBlockBufferFutex = ShmSPSCBlockBufferBase<6>;
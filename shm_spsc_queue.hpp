@@ -0,0 +1,405 @@
+/*
+ * ShmSPSCQueue. A fixed-size queue in shared memory which connects a producer process and a consumer process.
+ * Copyright (C) 2017  Kelvin Ng
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "wait.hpp"
+#include "shm_region.hpp"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <system_error>
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+/*
+ * The linked queue of SPSCQueueBase laid out in a shared memory object, for a producer process and a consumer process.
+ * Each process holds its own ShmSPSCQueueBase, made by create() or attach() with its ShmRole. Nodes are linked by their
+ * offsets in the shared memory, since it is mapped at different addresses. They are all allocated by create(), so at
+ * most capacity elements can be in the queue.
+ * T must be trivially copyable, and must not point to memory of either process.
+ * mode:
+ *     - 0: wait-free. push() fails when the queue is full, and pop() fails when it is empty
+ *     - 1: wait by spinning
+ *     - 6: wait by futex, shared between the processes. The notifier only pays a fence and a load when nobody sleeps
+ * A waiting side checks every peer_check_ms milliseconds whether the peer is gone (see ShmPeer). Then push() fails, and
+ * pop() fails once the queue is empty. A crashed side can be replaced by attaching again with its role, in which case
+ * a node being pushed or popped at the crash may be lost.
+ */
+
+// Some guarantees:
+//  1. Thread-safe with single-consumer and single-producer, which can be in different processes
+//  2. Offsets are from the start of the shared memory. 0 is never a node
+//  3. There is always one node in the queue, the dummy head. tail->next is 0
+//  4. Empty when there is only one node. head->next is the front. tail is the back
+//  5. head and free_tail are written only by the consumer, but are read by both sides
+//  6. tail and free_head are written only by the producer, but are read by both sides
+//  7. The nodes in [free_head, free_tail) are free. free_tail is never taken, since the consumer links the next free
+//     node to it
+//  8. The shared fields hold a consistent state whenever the writer stops, so a side can be attached again after a crash.
+//     A node taken from the free list is lost if it is not yet in the queue, and vice versa
+//  9. head_, free_tail_ and tail_cache_ are read or written only by the consumer. tail_cache_ is a possibly outdated tail
+// 10. tail_, free_head_ and free_tail_cache_ are read or written only by the producer. free_tail_cache_ is a possibly
+//     outdated free_tail
+// 11. The fields owned by the producer and the consumer are on different cache lines of the shared memory
+
+template <typename T, int mode, unsigned peer_check_ms = 100>
+class ShmSPSCQueueBase {
+    static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable to be shared between processes");
+    static_assert(mode == 0 || mode == 1 || mode == 6, "mode must be 0, 1 or 6");
+
+ public:
+    ShmSPSCQueueBase()
+        : shared_(nullptr), role_(ShmRole::producer), head_(0), free_tail_(0), tail_cache_(0), tail_(0), free_head_(0),
+          free_tail_cache_(0) {}
+
+    ShmSPSCQueueBase(ShmSPSCQueueBase&& other) : ShmSPSCQueueBase() {
+        *this = std::move(other);
+    }
+
+    ShmSPSCQueueBase& operator=(ShmSPSCQueueBase&& other) {
+        if (this != &other) {
+            detach();
+            region_ = std::move(other.region_);
+            shared_ = other.shared_;
+            role_ = other.role_;
+            head_ = other.head_;
+            free_tail_ = other.free_tail_;
+            tail_cache_ = other.tail_cache_;
+            tail_ = other.tail_;
+            free_head_ = other.free_head_;
+            free_tail_cache_ = other.free_tail_cache_;
+            other.shared_ = nullptr;
+        }
+        return *this;
+    }
+
+    ~ShmSPSCQueueBase() {
+        detach();
+    }
+
+    // Create the shared memory object name for a queue of at most capacity elements, and attach as role
+    static ShmSPSCQueueBase create(const char* name, size_t capacity, ShmRole role) {
+        ShmSPSCQueueBase q;
+        q.region_ = ShmRegion::create(name, region_size(capacity));
+        q.init(capacity);
+        q.open(role);
+        return q;
+    }
+
+    // Create an anonymous queue of at most capacity elements, and attach as role. Pass fd() to the other process
+    static ShmSPSCQueueBase create(size_t capacity, ShmRole role) {
+        ShmSPSCQueueBase q;
+        q.region_ = ShmRegion::create(region_size(capacity));
+        q.init(capacity);
+        q.open(role);
+        return q;
+    }
+
+    // Attach to the queue in the shared memory object name as role
+    // Throw std::system_error with EAGAIN if it is not initialized yet, EINVAL if it is not a queue of T, and EBUSY if a
+    // live process is attached as role
+    static ShmSPSCQueueBase attach(const char* name, ShmRole role) {
+        ShmSPSCQueueBase q;
+        q.region_ = ShmRegion::attach(name);
+        q.open(role);
+        return q;
+    }
+
+    // Same as attach(name, role), with the fd of the shared memory object. fd is not taken over
+    static ShmSPSCQueueBase attach(int fd, ShmRole role) {
+        ShmSPSCQueueBase q;
+        q.region_ = ShmRegion::attach(fd);
+        q.open(role);
+        return q;
+    }
+
+    // Detach and unmap, so that the peer sees this side as detached. Called by the destructor
+    void detach() {
+        if (shared_ != nullptr) {
+            shared_->peers[static_cast<int>(role_)].release();
+            shared_ = nullptr;
+            region_ = ShmRegion();
+        }
+    }
+
+    inline int fd() const {
+        return region_.fd();
+    }
+
+    inline size_t capacity() const {
+        return shared_->capacity;
+    }
+
+    inline ShmPeerState peer_state() const {
+        return peer().state();
+    }
+
+    // Producer only
+    // Wait according to mode if the queue is full
+    // @return: false if the queue is full in mode 0, or if the consumer is gone
+    inline bool push(const T& obj) {
+        return emplace(obj);
+    }
+
+    // Producer only
+    // Wait according to mode if the queue is full
+    // @return: false if the queue is full in mode 0, or if the consumer is gone
+    template <typename... Args>
+    bool emplace(Args&&... args) {
+        if (!shm_wait_until<mode, peer_check_ms>([&]{return !full();}, shared_->room, peer(),
+                                                 std::chrono::steady_clock::time_point::max())) {
+            return false;
+        }
+        put(std::forward<Args>(args)...);
+        return true;
+    }
+
+    // Producer only
+    // Never wait
+    // @return: false if the queue is full
+    inline bool try_push(const T& obj) {
+        if (full()) {
+            return false;
+        }
+        put(obj);
+        return true;
+    }
+
+    // Consumer only
+    // Wait according to mode if the queue is empty
+    // @return: false if the queue is empty in mode 0, or if it is empty and the producer is gone
+    inline bool pop(T& obj) {
+        return pop_until(obj, std::chrono::steady_clock::time_point::max());
+    }
+
+    // Consumer only
+    // Never wait
+    // @return: false if the queue is empty
+    inline bool try_pop(T& obj) {
+        if (empty()) {
+            return false;
+        }
+        take(obj);
+        return true;
+    }
+
+    // Consumer only
+    // Wait according to mode until there is an element or deadline is reached
+    // @return: false on timeout, or if the queue is empty and the producer is gone
+    template <typename Clock, typename Duration>
+    bool pop_until(T& obj, const std::chrono::time_point<Clock, Duration>& deadline) {
+        if (!shm_wait_until<mode, peer_check_ms>([&]{return !empty();}, shared_->data, peer(), deadline)) {
+            return false;
+        }
+        take(obj);
+        return true;
+    }
+
+    // Consumer only
+    template <typename Rep, typename Period>
+    inline bool pop_for(T& obj, const std::chrono::duration<Rep, Period>& timeout) {
+        return pop_until(obj, std::chrono::steady_clock::now() + timeout);
+    }
+
+    // Consumer only
+    inline bool empty() {
+        if (head_ != tail_cache_) {
+            return false;
+        }
+        tail_cache_ = __atomic_load_n(&shared_->tail, __ATOMIC_ACQUIRE);
+        return head_ == tail_cache_;
+    }
+
+    // Producer only
+    inline bool full() {
+        if (free_head_ != free_tail_cache_) {
+            return false;
+        }
+        free_tail_cache_ = __atomic_load_n(&shared_->free_tail, __ATOMIC_ACQUIRE);
+        return free_head_ == free_tail_cache_;
+    }
+
+ private:
+    static constexpr uint64_t shm_magic = 0x5350534351554555ULL;
+
+    struct Node {
+        inline T& obj() {
+            return *reinterpret_cast<T*>(&storage);
+        }
+
+        uint64_t next;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+
+    struct Shared {
+        uint64_t magic;
+        uint64_t elem_size;
+        uint64_t elem_align;
+        uint64_t capacity;
+        ShmPeer peers[2];
+
+        // Owned by the consumer
+        alignas(CACHE_LINE_SIZE) uint64_t head;
+        uint64_t free_tail;
+
+        // Owned by the producer
+        alignas(CACHE_LINE_SIZE) uint64_t tail;
+        uint64_t free_head;
+
+        // The consumer waits for data, and the producer waits for room
+        alignas(CACHE_LINE_SIZE) SharedFutexWaiter data;
+        alignas(CACHE_LINE_SIZE) SharedFutexWaiter room;
+    };
+
+    static inline size_t nodes_offset() {
+        return (sizeof(Shared) + alignof(Node) - 1) / alignof(Node) * alignof(Node);
+    }
+
+    // One more node for the dummy head, and one more for free_tail
+    static inline size_t region_size(size_t capacity) {
+        return nodes_offset() + (capacity + 2) * sizeof(Node);
+    }
+
+    inline Node* node(uint64_t offset) const {
+        return reinterpret_cast<Node*>(region_.data() + offset);
+    }
+
+    inline const ShmPeer& peer() const {
+        return shared_->peers[role_ == ShmRole::producer ? 1 : 0];
+    }
+
+    // Lay out the queue in newly created memory. The first node is the dummy head, and the others are free
+    void init(size_t capacity) {
+        Shared* shared = new (region_.data()) Shared();
+        shared->elem_size = sizeof(T);
+        shared->elem_align = alignof(T);
+        shared->capacity = capacity;
+
+        uint64_t first = nodes_offset();
+        for (size_t i = 0; i < capacity + 2; ++i) {
+            node(first + i * sizeof(Node))->next = 0;
+        }
+        for (size_t i = 1; i < capacity + 1; ++i) {
+            node(first + i * sizeof(Node))->next = first + (i + 1) * sizeof(Node);
+        }
+        shared->head = first;
+        shared->tail = first;
+        shared->free_head = first + sizeof(Node);
+        shared->free_tail = first + (capacity + 1) * sizeof(Node);
+
+        // Published last, so that a process attaching by name never sees a half-initialized queue
+        __atomic_store_n(&shared->magic, shm_magic, __ATOMIC_RELEASE);
+    }
+
+    // Check the queue and attach as role
+    void open(ShmRole role) {
+        if (region_.size() < sizeof(Shared)) {
+            throw std::system_error(EAGAIN, std::generic_category(), "ShmSPSCQueueBase::open");
+        }
+        Shared* shared = reinterpret_cast<Shared*>(region_.data());
+        uint64_t m = __atomic_load_n(&shared->magic, __ATOMIC_ACQUIRE);
+        if (m == 0) {
+            throw std::system_error(EAGAIN, std::generic_category(), "ShmSPSCQueueBase::open");
+        }
+        if (m != shm_magic || shared->elem_size != sizeof(T) || shared->elem_align != alignof(T) ||
+                region_.size() < region_size(shared->capacity)) {
+            throw std::system_error(EINVAL, std::generic_category(), "ShmSPSCQueueBase::open");
+        }
+
+        shared->peers[static_cast<int>(role)].claim();
+        shared_ = shared;
+        role_ = role;
+        if (role == ShmRole::consumer) {
+            head_ = __atomic_load_n(&shared->head, __ATOMIC_ACQUIRE);
+            free_tail_ = __atomic_load_n(&shared->free_tail, __ATOMIC_ACQUIRE);
+            tail_cache_ = head_;
+        } else {
+            tail_ = __atomic_load_n(&shared->tail, __ATOMIC_ACQUIRE);
+            free_head_ = __atomic_load_n(&shared->free_head, __ATOMIC_ACQUIRE);
+            free_tail_cache_ = free_head_;
+        }
+    }
+
+    // Producer only. The queue must not be full
+    template <typename... Args>
+    inline void put(Args&&... args) {
+        uint64_t offset = free_head_;
+        Node* n = node(offset);
+        free_head_ = n->next;
+        // free_head is stored before the taken node is changed, so that a crash in between only loses the node
+        __atomic_store_n(&shared_->free_head, free_head_, __ATOMIC_RELAXED);
+        __atomic_store_n(&n->next, 0, __ATOMIC_RELEASE);
+        new (&n->storage) T(std::forward<Args>(args)...);
+
+        node(tail_)->next = offset;
+        tail_ = offset;
+        __atomic_store_n(&shared_->tail, tail_, __ATOMIC_RELEASE);
+        if (mode == 6) {
+            shared_->data.notify();
+        }
+    }
+
+    // Consumer only. The queue must not be empty
+    // The old dummy head becomes free_tail, and the front becomes the dummy head
+    inline void take(T& obj) {
+        uint64_t old_head = head_;
+        head_ = node(old_head)->next;
+        obj = node(head_)->obj();
+
+        // head is stored first, so that a crash in between only loses old_head
+        __atomic_store_n(&shared_->head, head_, __ATOMIC_RELAXED);
+        node(free_tail_)->next = old_head;
+        __atomic_store_n(&node(old_head)->next, 0, __ATOMIC_RELEASE);
+        free_tail_ = old_head;
+        __atomic_store_n(&shared_->free_tail, free_tail_, __ATOMIC_RELEASE);
+        if (mode == 6) {
+            shared_->room.notify();
+        }
+    }
+
+    ShmRegion region_;
+    Shared* shared_;
+    ShmRole role_;
+
+    // Owned by the consumer
+    uint64_t head_;
+    uint64_t free_tail_;
+    uint64_t tail_cache_;
+
+    // Owned by the producer
+    uint64_t tail_;
+    uint64_t free_head_;
+    uint64_t free_tail_cache_;
+};
+
+template <typename T>
+using ShmSPSCQueue = ShmSPSCQueueBase<T, 0>;
+
+template <typename T>
+using ShmSPSCQueueSpin = ShmSPSCQueueBase<T, 1>;
+
+template <typename T>
+using ShmSPSCQueueFutex = ShmSPSCQueueBase<T, 6>;
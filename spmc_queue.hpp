@@ -0,0 +1,242 @@
+/*
+ * SPMCQueue. A fixed-size queue which allows thread-safe manipulations in a single-producer multi-consumer setting.
+ * Copyright (C) 2017  Kelvin Ng
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "spsc_queue.hpp"
+#include "wait.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <memory>
+#include <chrono>
+#include <type_traits>
+#include <condition_variable>
+
+/*
+ * A fixed-size queue for multi-consumer and single-producer setting, for handing work from a dispatcher to a pool.
+ * Each slot carries a sequence number, so a consumer that has claimed a slot but not finished reading it keeps the
+ * producer from reusing the slot. capacity must be a power of two.
+ * mode:
+ *     - 0: wait-free
+ *     - 1: wait by spinning
+ *     - 2: wait by condition variable
+ *     - 3: wait adaptively. Spin wait_spin_num times with pause, then yield wait_yield_num times, then sleep by futex
+ *     - 6: wait by futex
+ * Only the consumers wait. push() and emplace() never wait and return false when the queue is full.
+ */
+
+// Some guarantees:
+// 1. head_ and tail_ only increase. The i-th element is stored in slots_[i & (capacity - 1)]
+// 2. slots_[i & (capacity - 1)].seq == i when the slot is free for the i-th element
+// 3. slots_[i & (capacity - 1)].seq == i + 1 when the i-th element is published and not yet consumed
+// 4. A consumer claims the i-th element by a CAS of head_ from i to i + 1, and frees the slot by setting seq to i + capacity
+// 5. tail_ is read or written only by the producer
+// 6. head_ is written only by the consumers with CAS
+// 7. The fields owned by the producer and the consumers are on different cache lines
+
+template <typename T, size_t capacity, int mode, unsigned wait_spin_num = 1024, unsigned wait_yield_num = 16>
+class SPMCQueueBase {
+    static_assert(capacity > 0 && (capacity & (capacity - 1)) == 0, "capacity must be a power of two");
+
+ public:
+    // Not thread-safe
+    SPMCQueueBase() : slots_(new Slot[capacity]), head_(0), tail_(0) {
+        for (size_t i = 0; i < capacity; ++i) {
+            slots_[i].seq = i;
+        }
+    }
+
+    // Not thread-safe
+    ~SPMCQueueBase() {
+        for (; head_ != tail_; ++head_) {
+            slots_[head_ & (capacity - 1)].obj().~T();
+        }
+    }
+
+    // Thread-safe for only one producer
+    // Return false if the queue is full
+    inline bool push(const T& obj) {
+        return emplace(obj);
+    }
+
+    // Thread-safe for only one producer
+    // Return false if the queue is full
+    inline bool push(T&& obj) {
+        return emplace(std::move(obj));
+    }
+
+    // Thread-safe for only one producer
+    // Return false if the queue is full
+    template <typename... Args>
+    bool emplace(Args&&... args) {
+        Slot& slot = slots_[tail_ & (capacity - 1)];
+        if (__atomic_load_n(&slot.seq, __ATOMIC_ACQUIRE) != tail_) {
+            return false;
+        }
+
+        new (&slot.obj()) T(std::forward<Args>(args)...);
+        ++tail_;
+
+        if (mode == 2) {
+            std::unique_lock<std::mutex> lk(mtx_);
+            // Atomic is still needed because try_pop() does not acquire the lock
+            __atomic_store_n(&slot.seq, tail_, __ATOMIC_RELEASE);
+            lk.unlock();
+            cv_.notify_one();
+        } else if (mode == 3 || mode == 6) {
+            __atomic_store_n(&slot.seq, tail_, __ATOMIC_RELEASE);
+            futex_.notify();
+        } else {
+            __atomic_store_n(&slot.seq, tail_, __ATOMIC_RELEASE);
+        }
+
+        return true;
+    }
+
+    // Thread-safe for multiple consumers
+    // Never wait. Move the front to obj and pop it
+    // @return: false if the queue is empty
+    bool try_pop(T& obj) {
+        size_t pos = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+        Slot* slot;
+        for (;;) {
+            slot = &slots_[pos & (capacity - 1)];
+            intptr_t diff = (intptr_t)__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (__atomic_compare_exchange_n(&head_, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                    break;
+                }
+                // pos is reloaded by the failed CAS
+            } else if (diff < 0) {
+                return false;
+            } else {
+                // Another consumer has claimed pos
+                pos = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+            }
+        }
+
+        obj = std::move(slot->obj());
+        slot->obj().~T();
+        __atomic_store_n(&slot->seq, pos + capacity, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    // Thread-safe for multiple consumers
+    // Wait according to mode until an element is claimed. Move it to obj and pop it
+    // In mode 0, return false if the queue is empty
+    bool pop(T& obj) {
+        auto pred = [&]{return try_pop(obj);};
+        if (mode == 2) {
+            // Another consumer may win the element after waking up, so wait again if try_pop() fails
+            while (!pred()) {
+                std::unique_lock<std::mutex> lk(mtx_);
+                cv_.wait(lk, [&]{return !empty();});
+            }
+            return true;
+        } else if (mode == 1) {
+            while (!pred());
+            return true;
+        } else if (mode == 3) {
+            if (!spin_wait<wait_spin_num, wait_yield_num>(pred)) {
+                futex_.wait(pred);
+            }
+            return true;
+        } else if (mode == 6) {
+            futex_.wait(pred);
+            return true;
+        } else {
+            return pred();
+        }
+    }
+
+    // Thread-safe for multiple consumers
+    // Wait until an element is claimed or deadline is reached. Modes that do not block (0, 1) spin with cpu_relax()
+    // @return: false on timeout
+    template <typename Clock, typename Duration>
+    bool pop_until(T& obj, const std::chrono::time_point<Clock, Duration>& deadline) {
+        auto pred = [&]{return try_pop(obj);};
+        if (mode == 2) {
+            for (;;) {
+                if (pred()) {
+                    return true;
+                }
+                std::unique_lock<std::mutex> lk(mtx_);
+                if (!cv_.wait_until(lk, deadline, [&]{return !empty();})) {
+                    return false;
+                }
+            }
+        } else if (mode == 3) {
+            return spin_wait<wait_spin_num, wait_yield_num>(pred) || futex_.wait_until(pred, deadline);
+        } else if (mode == 6) {
+            return futex_.wait_until(pred, deadline);
+        } else {
+            return spin_wait_until(pred, deadline);
+        }
+    }
+
+    // Thread-safe for multiple consumers
+    // Same as pop_until(obj, now + timeout)
+    template <typename Rep, typename Period>
+    inline bool pop_for(T& obj, const std::chrono::duration<Rep, Period>& timeout) {
+        return pop_until(obj, std::chrono::steady_clock::now() + timeout);
+    }
+
+    // Thread-safe for multiple consumers
+    // The result may be outdated as soon as it returns
+    inline bool empty() const {
+        size_t pos = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+        return __atomic_load_n(&slots_[pos & (capacity - 1)].seq, __ATOMIC_ACQUIRE) != pos + 1;
+    }
+
+ private:
+    class Slot {
+     public:
+        inline T& obj() {
+            return *reinterpret_cast<T*>(&storage);
+        }
+
+        size_t seq;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+
+    std::unique_ptr<Slot[]> slots_;
+
+    // Shared by the consumers
+    alignas(CACHE_LINE_SIZE) size_t head_;
+
+    // Owned by the producer
+    alignas(CACHE_LINE_SIZE) size_t tail_;
+
+    alignas(CACHE_LINE_SIZE) std::mutex mtx_;
+    std::condition_variable cv_;
+    FutexWaiter futex_;
+};
+
+template <typename T, size_t capacity>
+using SPMCQueue = SPMCQueueBase<T, capacity, 0>;
+
+template <typename T, size_t capacity>
+using SPMCQueueSpin = SPMCQueueBase<T, capacity, 1>;
+
+template <typename T, size_t capacity>
+using SPMCQueueCV = SPMCQueueBase<T, capacity, 2>;
+
+template <typename T, size_t capacity>
+using SPMCQueueFutex = SPMCQueueBase<T, capacity, 6>;
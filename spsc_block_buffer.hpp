@@ -19,10 +19,11 @@
 #pragma once
 
 #include "spsc_queue.hpp"
+#include "wait_policy.hpp"
 
 #include <unistd.h>
-#include <sys/eventfd.h>
 
+#include <cerrno>
 #include <queue>
 #include <memory>
 #include <cassert>
@@ -39,28 +40,46 @@
 // 3. &buf_.front().second == wpos if there is exactly one block
 // 4. Memory is never moved
 // 5. Data is always valid until explicitly removed with clear_preserved()
-// 6. rpos_ is read or written only by the consumer
+// 6. rpos_ and cleared_ are read or written only by the consumer
 // 7. wpos_ is written only by the producer, but is read by both the producer and consumer
 // 8. *wpos_ is written only by the producer, but is read by both the producer and consumer
 // 9. non_notified_size_ is read or written only by the producer
 //10. one_block_left_ is read or written only by the consumer
 //11. When one_block_left_ is false, there must be more than one block. No guarantee when one_block_left_ is true
+//12. one_block_left_ is the consumer-side cached copy of wpos_. wpos_ is read by the consumer only when one_block_left_ is true
+//13. The fields owned by the producer and the consumer are on different cache lines
+//14. blocks_freed_ is written only by the consumer after the blocks are in free_list_, but is read by both the producer and
+//    consumer. It is the number of blocks ever given back by clear_preserved(), which CapacityPolicy compares with the
+//    number of blocks ever added
+//15. cleared_ is the number of bytes passed to clear_preserved() but not yet given back with a whole block. Each block in
+//    preserved_list_ is kept with the number of bytes read from it
 
-template <int mode, unsigned notify_interval = 1, unsigned long long wait_timeout = 0, unsigned wait_spin_cv_num = 1>
-class SPSCBlockBufferBase {
+/*
+ * A buffer for single-consumer and single-producer setting, configured by policy types (see wait_policy.hpp):
+ *     - WaitPolicy: how the consumer waits. NoWait, SpinWait, CVWait, SpinCVWait, CVTimeoutWait or FutexWait
+ *     - NotifyPolicy: NoNotify, or EventFdNotify to signal get_eventfd() when data arrives. Consume with drain()
+ *     - CapacityPolicy: Unbounded, or Bounded<WaitPolicy> to keep at most set_max_bytes(). When the producer needs a new
+ *       block over the limit, it calls notify() and waits by WaitPolicy. With Bounded<NoWait>, write() and write_cont()
+ *       write nothing and return false, ensure_cont() returns nullptr, and input_from_fd() stops, returning -1 with
+ *       errno ENOBUFS if nothing is read. A block counts until the consumer gives it back with clear_preserved()
+ */
+
+template <typename WaitPolicy, typename NotifyPolicy = NoNotify, typename CapacityPolicy = Unbounded>
+class BasicSPSCBlockBuffer : private WaitPolicy, private NotifyPolicy, private CapacityPolicy {
  public:
-    SPSCBlockBufferBase() = default;
+    BasicSPSCBlockBuffer() = default;
 
-    SPSCBlockBufferBase(ssize_t block_size) {
+    BasicSPSCBlockBuffer(ssize_t block_size) {
         init(block_size);
     }
 
-    SPSCBlockBufferBase(SPSCBlockBufferBase&&) = default;
+    BasicSPSCBlockBuffer(BasicSPSCBlockBuffer&&) = default;
 
     void init(ssize_t block_size = -1) {
         rpos_ = 0;
         wpos_private_ = 0;
         one_block_left_ = true;
+        cleared_ = 0;
         if (block_size == -1) {
             block_size_ = sysconf(_SC_PAGESIZE);
             //block_size_ = sysconf(_SC_PAGESIZE) * 100;
@@ -69,22 +88,59 @@ class SPSCBlockBufferBase {
         }
         buf_.emplace(new char[block_size_], 0);
         wpos_ = &buf_.back().second;
-        if (mode == 5) {
-            eventfd_ = eventfd(0, EFD_NONBLOCK);
-        }
+        blocks_freed_ = 0;
+        CapacityPolicy::acquire(1);
     }
 
     inline int get_eventfd() const {
-        return eventfd_;
+        return NotifyPolicy::get_eventfd();
+    }
+
+    // For producer only, after init()
+    // Let the blocks not yet given back by the consumer take at most bytes, rounded up to whole blocks and at least two
+    // blocks. Ignored with Unbounded
+    inline void set_max_bytes(size_t bytes) {
+        CapacityPolicy::set_limit(std::max((bytes + block_size_ - 1) / block_size_, (size_t)2));
+    }
+
+    // EventFdNotify only. For consumer only
+    // Clear get_eventfd() with a single read(), then call fn() while the buffer is not empty. fn() should consume data,
+    // e.g. with output_to_fd(), and return false to stop early.
+    // @return: true when the buffer stays empty after the consumer is marked idle, so the next notify() signals
+    //          get_eventfd() again. false when fn() stops early, in which case drain() should be called again later
+    template <typename FuncT>
+    bool drain(FuncT fn) {
+        NotifyPolicy::clear();
+
+        for (;;) {
+            while (!empty()) {
+                if (!fn()) {
+                    return false;
+                }
+            }
+
+            if (NotifyPolicy::rest([&]{return empty();})) {
+                return true;
+            }
+        }
     }
 
     // write [write_start, write_end) to the buffer
-    void write(const char* write_start, const char* write_end, bool notify = true) {
+    // @return: false if nothing is written because of the limit with Bounded<NoWait>
+    bool write(const char* write_start, const char* write_end, bool notify = true) {
         //// TODO: Probably an optimization for branch prediction
         //if (write_start >= write_end) {
         //    return;
         //}
 
+        IF_CONSTEXPR(CapacityPolicy::may_fail) {
+            size_t len = write_start < write_end ? write_end - write_start : 0;
+            size_t left = block_size_ - wpos_private_;
+            if (len > left && !reserve_blocks((len - left + block_size_ - 1) / block_size_)) {
+                return false;
+            }
+        }
+
         while (write_start < write_end) {
             add_block_if_needed();
 
@@ -97,17 +153,26 @@ class SPSCBlockBufferBase {
         if (notify) {
             this->notify();
         }
+        return true;
     }
 
     template <typename T>
-    inline void write(const T& ptr, bool notify = true) {
-        write((const char*)&ptr, (const char*)(&ptr + 1), notify);
+    inline bool write(const T& ptr, bool notify = true) {
+        return write((const char*)&ptr, (const char*)(&ptr + 1), notify);
     }
 
-    void write(const std::string& str, bool notify = true) {
+    bool write(const std::string& str, bool notify = true) {
         size_t size = str.size();
+        IF_CONSTEXPR(CapacityPolicy::may_fail) {
+            size_t len = sizeof(size) + size;
+            size_t left = block_size_ - wpos_private_;
+            if (len > left && !reserve_blocks((len - left + block_size_ - 1) / block_size_)) {
+                return false;
+            }
+        }
         write(size, false);
         write(str.c_str(), str.c_str() + size, notify);
+        return true;
     }
 
     template <typename T>
@@ -157,13 +222,16 @@ class SPSCBlockBufferBase {
     }
 
     // write [write_start, write_end) to the buffer
-    void write_cont(const char* write_start, const char* write_end, bool notify = true) {
+    // @return: false if nothing is written because of the limit with Bounded<NoWait>
+    bool write_cont(const char* write_start, const char* write_end, bool notify = true) {
         if (write_start >= write_end) {
-            return;
+            return true;
         }
 
         size_t to_write = write_end - write_start;
-        add_block_if_needed(to_write);
+        if (!add_block_if_needed(to_write)) {
+            return false;
+        }
 
         std::copy(write_start, write_end, buf_.back().first.get() + wpos_private_);
 
@@ -172,24 +240,41 @@ class SPSCBlockBufferBase {
         if (notify) {
             this->notify();
         }
+        return true;
     }
 
     template <typename T>
-    inline void write_cont(const T& ptr, bool notify = true) {
-        write_cont((const char*)&ptr, (const char*)&ptr + sizeof(T), notify);
+    inline bool write_cont(const T& ptr, bool notify = true) {
+        return write_cont((const char*)&ptr, (const char*)&ptr + sizeof(T), notify);
     }
 
-    void write_cont(const std::string& str, bool notify = true) {
+    bool write_cont(const std::string& str, bool notify = true) {
         size_t size = str.size();
+        IF_CONSTEXPR(CapacityPolicy::may_fail) {
+            // The string needs a new block, and so does the length if it does not fit in the current block. Both share
+            // the new block when they fit in it
+            size_t left = block_size_ - wpos_private_;
+            if (sizeof(size) + size > left &&
+                    !reserve_blocks(sizeof(size) <= left || sizeof(size) + size <= block_size_ ? 1 : 2)) {
+                return false;
+            }
+        }
         write_cont(size, false);
         write_cont(str.c_str(), str.c_str() + size, notify);
+        return true;
     }
 
     inline ssize_t input_from_fd(int fd, bool cont = false, ssize_t max_len = -1) {
         ssize_t total_len = 0;
 
         for (;;) {
-            add_block_if_needed();
+            if (!add_block_if_needed()) {
+                if (total_len == 0) {
+                    errno = ENOBUFS;
+                    return -1;
+                }
+                break;
+            }
 
             ssize_t len;
             if (max_len == -1) {
@@ -271,35 +356,15 @@ class SPSCBlockBufferBase {
     }
 
     void notify() {
-        IF_CONSTEXPR(mode == 2 || mode == 3) {
-            std::unique_lock<std::mutex> lk(mtx_);
-            // Atomic is still needed because empty() does not acquire the lock
-            __atomic_store_n(wpos_, wpos_private_, __ATOMIC_RELEASE);
-            lk.unlock();
-            cv_.notify_one();
-        } else IF_CONSTEXPR(mode == 4) {
-            ++notify_counter;
-            if (notify_counter == notify_interval) {
-                notify_counter = 0;
-                std::unique_lock<std::mutex> lk(mtx_);
-                // Atomic is still needed because empty() does not acquire the lock
-                __atomic_store_n(wpos_, wpos_private_, __ATOMIC_RELEASE);
-                lk.unlock();
-                cv_.notify_one();
-            } else {
-                __atomic_store_n(wpos_, wpos_private_, __ATOMIC_RELEASE);
-            }
-        } else IF_CONSTEXPR(mode == 5) {
-            __atomic_store_n(wpos_, wpos_private_, __ATOMIC_RELEASE);
-            uint64_t tmp = 1;
-            ::write(eventfd_, &tmp, sizeof(tmp));
-        } else {
-            __atomic_store_n(wpos_, wpos_private_, __ATOMIC_RELEASE);
-        }
+        WaitPolicy::notify([&]{__atomic_store_n(wpos_, wpos_private_, __ATOMIC_RELEASE);});
+        NotifyPolicy::notify();
     }
 
+    // @return: nullptr if there is no room because of the limit with Bounded<NoWait>
     inline char* ensure_cont(size_t size) {
-        add_block_if_needed(size);
+        if (!add_block_if_needed(size)) {
+            return nullptr;
+        }
         return buf_.back().first.get() + wpos_private_;
     }
 
@@ -313,16 +378,21 @@ class SPSCBlockBufferBase {
         return one_block_left_ && (one_block_left_ = check_one_block_left()) && rpos_ == __atomic_load_n(wpos_, __ATOMIC_ACQUIRE);
     }
 
+    // Give back the bytes read so far, in the order they were read. len adds up across calls, so a block is given back
+    // once all bytes read from it are cleared, even by many small calls
     inline void clear_preserved(size_t len) {
-        size_t cleared_len = 0;
-        for (;;) {
-            if (!preserved_list_.empty() && preserved_list_.front().second + cleared_len <= len) {
-                cleared_len += preserved_list_.front().second;
-                free_list_.push(std::move(preserved_list_.front().first));
-                preserved_list_.pop();
-            } else {
-                break;
-            }
+        cleared_ += len;
+        size_t num_freed = 0;
+        while (!preserved_list_.empty() && preserved_list_.front().second <= cleared_) {
+            cleared_ -= preserved_list_.front().second;
+            free_list_.push(std::move(preserved_list_.front().first));
+            preserved_list_.pop();
+            ++num_freed;
+        }
+
+        if (num_freed > 0) {
+            __atomic_store_n(&blocks_freed_, blocks_freed_ + num_freed, __ATOMIC_RELEASE);
+            CapacityPolicy::release();
         }
     }
 
@@ -338,18 +408,44 @@ class SPSCBlockBufferBase {
             free_list_.pop();
         }
         __atomic_store_n(&wpos_, &buf_.back().second, __ATOMIC_RELEASE);
+        CapacityPolicy::acquire(1);
     }
 
-    inline void add_block_if_needed() {
+    // @return: false if the block cannot be added with Bounded<NoWait>
+    inline bool add_block_if_needed() {
         if (wpos_private_ == block_size_) {
+            if (!reserve_blocks(1)) {
+                return false;
+            }
             add_block();
         }
+        return true;
     }
 
-    inline void add_block_if_needed(size_t cont_write_len) {
+    // @return: false if the block cannot be added with Bounded<NoWait>
+    inline bool add_block_if_needed(size_t cont_write_len) {
         if (cont_write_len > block_size_ - wpos_private_) {
+            if (!reserve_blocks(1)) {
+                return false;
+            }
             add_block();
         }
+        return true;
+    }
+
+    // For producer only
+    // Wait by CapacityPolicy until num_blocks more blocks can be added
+    // @return: false if they cannot be added with Bounded<NoWait>
+    inline bool reserve_blocks(size_t num_blocks) {
+        if (!CapacityPolicy::full(&blocks_freed_, num_blocks)) {
+            return true;
+        }
+        IF_CONSTEXPR(CapacityPolicy::may_fail) {
+            return false;
+        }
+        // The consumer can only give back blocks that it has seen
+        notify();
+        return CapacityPolicy::wait_room([&]{return !CapacityPolicy::full(&blocks_freed_, num_blocks);});
     }
 
     inline bool check_one_block_left() const {
@@ -357,7 +453,8 @@ class SPSCBlockBufferBase {
     }
 
     void pop_block() {
-        preserved_list_.push(std::move(buf_.front()));
+        // Bytes left unread at the end of the block are never passed to clear_preserved()
+        preserved_list_.emplace(std::move(buf_.front().first), rpos_);
         buf_.pop();
         rpos_ = 0;
         one_block_left_ = check_one_block_left();
@@ -375,7 +472,7 @@ class SPSCBlockBufferBase {
     }
 
     inline void pop_block_if_needed(size_t size) {
-        IF_CONSTEXPR(mode == 0) {
+        IF_CONSTEXPR(!WaitPolicy::blocking) {
             if (one_block_left_) {
                 if (!check_one_block_left() && buf_.front().second - rpos_ < size) {
                     pop_block();
@@ -409,7 +506,7 @@ class SPSCBlockBufferBase {
                 }
             }
         } else if (mode == 2) {*/
-        } else IF_CONSTEXPR(mode == 1 || mode == 2 || mode == 3 || mode == 4) {
+        } else {
             if (one_block_left_) {
                 wait([&]{return !(check_one_block_left() && __atomic_load_n(&buf_.front().second, __ATOMIC_ACQUIRE) - rpos_ < size);});
                 if (__atomic_load_n(&buf_.front().second, __ATOMIC_ACQUIRE) - rpos_ < size) {
@@ -431,50 +528,79 @@ class SPSCBlockBufferBase {
 
     template <typename PredicateT>
     inline void wait(PredicateT pred) {
-        IF_CONSTEXPR(mode == 1) {
-            while (!pred()); // TODO: it seems that the NOT operation takes some time, but for now keep it for easy maintainence
-        } else IF_CONSTEXPR(mode == 2) {
-            if (!pred()) {
-                std::unique_lock<std::mutex> lk(mtx_);
-                cv_.wait(lk, pred);
-            }
-        } else IF_CONSTEXPR(mode == 3) {
-            for (int i = 0; i < wait_spin_cv_num; ++i) {
-                if (pred()) {
-                    return;
-                }
-            }
-            std::unique_lock<std::mutex> lk(mtx_);
-            cv_.wait(lk, pred);
-        } else IF_CONSTEXPR(mode == 4) {
-            while (!pred()) {
-                std::unique_lock<std::mutex> lk(mtx_);
-                cv_.wait_for(lk, std::chrono::microseconds(wait_timeout), pred);
-            }
-        }
+        WaitPolicy::wait(pred);
     }
 
-    size_t block_size_;
     SPSCQueue<std::pair<std::unique_ptr<char[]>, size_t>> buf_;
     SPSCQueue<std::unique_ptr<char[]>> free_list_;
     SPSCQueue<std::pair<std::unique_ptr<char[]>, size_t>> preserved_list_;
-    size_t rpos_;
+
+    // Rarely written
+    alignas(CACHE_LINE_SIZE) size_t block_size_;
     size_t* wpos_;
-    size_t wpos_private_;
 
+    // Owned by the consumer
+    alignas(CACHE_LINE_SIZE) size_t rpos_;
     bool one_block_left_;
+    size_t blocks_freed_;
+    size_t cleared_;
+
+    // Owned by the producer
+    alignas(CACHE_LINE_SIZE) size_t wpos_private_;
+};
+
+// The policies of the integer modes
+// mode:
+//     - 0: wait-free
+//     - 1: wait by spinning
+//     - 2: wait by condition variable
+//     - 3: check wait_spin_cv_num times, then wait by condition variable
+//     - 4: wait by condition variable with wait_timeout microseconds of timeout. Only every notify_interval notify()
+//          takes the lock
+//     - 5: wait-free, and signal get_eventfd() when data arrives. Consume with drain()
+//     - 6: wait by futex. The producer only pays a fence and a load when the consumer is not sleeping
+// limit_policy is the same as ModeCapacityPolicy in spsc_queue.hpp
+template <int mode, unsigned notify_interval, unsigned long long wait_timeout, unsigned wait_spin_cv_num>
+struct BlockBufferModeWaitPolicy {
+    typedef NoWait type;
+};
 
-    std::mutex mtx_;
-    std::condition_variable cv_;
-    int notify_counter = 0;
+template <unsigned notify_interval, unsigned long long wait_timeout, unsigned wait_spin_cv_num>
+struct BlockBufferModeWaitPolicy<1, notify_interval, wait_timeout, wait_spin_cv_num> {
+    typedef SpinWait type;
+};
+
+template <unsigned notify_interval, unsigned long long wait_timeout, unsigned wait_spin_cv_num>
+struct BlockBufferModeWaitPolicy<2, notify_interval, wait_timeout, wait_spin_cv_num> {
+    typedef CVWait type;
+};
+
+template <unsigned notify_interval, unsigned long long wait_timeout, unsigned wait_spin_cv_num>
+struct BlockBufferModeWaitPolicy<3, notify_interval, wait_timeout, wait_spin_cv_num> {
+    typedef SpinCVWait<wait_spin_cv_num> type;
+};
+
+template <unsigned notify_interval, unsigned long long wait_timeout, unsigned wait_spin_cv_num>
+struct BlockBufferModeWaitPolicy<4, notify_interval, wait_timeout, wait_spin_cv_num> {
+    typedef CVTimeoutWait<notify_interval, wait_timeout> type;
+};
 
-    int eventfd_;
+template <unsigned notify_interval, unsigned long long wait_timeout, unsigned wait_spin_cv_num>
+struct BlockBufferModeWaitPolicy<6, notify_interval, wait_timeout, wait_spin_cv_num> {
+    typedef FutexWait type;
 };
 
+template <int mode, unsigned notify_interval = 1, unsigned long long wait_timeout = 0, unsigned wait_spin_cv_num = 1,
+          int limit_policy = 0>
+using SPSCBlockBufferBase = BasicSPSCBlockBuffer<
+    typename BlockBufferModeWaitPolicy<mode, notify_interval, wait_timeout, wait_spin_cv_num>::type,
+    typename ModeNotifyPolicy<mode>::type, typename ModeCapacityPolicy<limit_policy>::type>;
+
 using SPSCBlockBuffer = SPSCBlockBufferBase<0>;
 using SPSCBlockBufferSpin = SPSCBlockBufferBase<1>;
 using SPSCBlockBufferCV = SPSCBlockBufferBase<2>;
 using SPSCBlockBufferEventFd = SPSCBlockBufferBase<5>;
+using SPSCBlockBufferFutex = SPSCBlockBufferBase<6>;
 
 template <unsigned wait_spin_cv_num>
 using SPSCBlockBufferSpinCV = SPSCBlockBufferBase<3, 1, 0, wait_spin_cv_num>;
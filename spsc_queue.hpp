@@ -18,17 +18,28 @@
 
 #pragma once
 
+#include "wait_policy.hpp"
+#include "node_allocator.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <iterator>
 #include <utility>
 #include <atomic>
 #include <memory>
+#include <type_traits>
 #include <condition_variable>
 
 /*
- * A queue for single-consumer and single-producer setting.
- * mode:
- *     - 0: wait-free
- *     - 1: wait by spinning
- *     - 2: wait by condition variable
+ * A queue for single-consumer and single-producer setting, configured by policy types (see wait_policy.hpp):
+ *     - WaitPolicy: how the consumer waits. NoWait, SpinWait, CVWait, AdaptiveWait or FutexWait
+ *     - NotifyPolicy: NoNotify, or EventFdNotify to signal get_eventfd() when the queue becomes non-empty. Consume with
+ *       drain()
+ *     - Allocator: where the nodes come from (see node_allocator.hpp), e.g. SlabAllocator to keep nodes together
+ *     - CapacityPolicy: Unbounded, or Bounded<WaitPolicy> to hold at most set_limit() elements. A push waits by
+ *       WaitPolicy when the queue is full, or fails with Bounded<NoWait>
+ * Policies without state take no space.
  */
 
 // Some guarantees:
@@ -38,184 +49,692 @@
 //  4. head_->next is the front
 //  5. tail_ is the back
 //  6. Elements are never moved
-//  7. head_ is read or written only by the consumer
-//  8. tail_ is written only by the producer, but is read by both the producer and consumer
-//  9. free_head_ is read or written only by the producer
-// 10. free_tail_ is written only by the consumer, but is read by both the producer and consumer
-
-// TODO: can I not to create mtx_ and cv_ when is_blocking == false?
-template <typename T, int mode>
-class SPSCQueueBase {
+//  7. Only the nodes after head_ hold constructed elements. The element of a node is destroyed as soon as it is popped
+//  8. head_ is read or written only by the consumer
+//  9. tail_ is written only by the producer, but is read by both the producer and consumer
+// 10. free_head_ is read or written only by the producer
+// 11. free_tail_ is written only by the consumer, but is read by both the producer and consumer
+// 12. tail_cache_ is read or written only by the consumer. It is a possibly outdated tail_
+// 13. free_tail_cache_ is read or written only by the producer. It is a possibly outdated free_tail_
+// 14. The fields owned by the producer and the consumer are on different cache lines
+// 15. recycled_ is written only by the consumer after free_tail_, but is read by both the producer and consumer. It is
+//     the number of elements ever popped, which CapacityPolicy compares with the number ever pushed
+// 16. taken_ and max_free_ are read or written only by the producer. recycled_ - taken_, when positive, never exceeds the
+//     number of nodes in [free_head_, free_tail_)
+// 17. alloc_ is used only by the producer, apart from construction and destruction
+
+template <typename T, typename WaitPolicy, typename NotifyPolicy = NoNotify, typename Allocator = HeapAllocator,
+          typename CapacityPolicy = Unbounded>
+class BasicSPSCQueue : private WaitPolicy, private NotifyPolicy, private CapacityPolicy {
+    class Node;
+
  public:
+    // A consumer-side view of the elements available at the time of peek(). Iterating does not pop
+    class View {
+     public:
+        class iterator {
+         public:
+            typedef std::forward_iterator_tag iterator_category;
+            typedef T value_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef T* pointer;
+            typedef T& reference;
+
+            explicit iterator(Node* prev) : prev_(prev) {}
+
+            inline T& operator*() const {
+                return prev_->next->obj();
+            }
+
+            inline T* operator->() const {
+                return &prev_->next->obj();
+            }
+
+            inline iterator& operator++() {
+                prev_ = prev_->next;
+                return *this;
+            }
+
+            inline iterator operator++(int) {
+                iterator tmp = *this;
+                prev_ = prev_->next;
+                return tmp;
+            }
+
+            inline bool operator==(const iterator& other) const {
+                return prev_ == other.prev_;
+            }
+
+            inline bool operator!=(const iterator& other) const {
+                return prev_ != other.prev_;
+            }
+
+         private:
+            // The element is prev_->next, so that the end can be the last node
+            Node* prev_;
+        };
+
+        View(Node* head, Node* tail) : head_(head), tail_(tail) {}
+
+        inline iterator begin() const {
+            return iterator(head_);
+        }
+
+        inline iterator end() const {
+            return iterator(tail_);
+        }
+
+        inline bool empty() const {
+            return head_ == tail_;
+        }
+
+     private:
+        Node* head_;
+        Node* tail_;
+    };
+
     // Not thread-safe
-    SPSCQueueBase() {
-        head_ = new Node();
+    BasicSPSCQueue() {
+        head_ = new (alloc_.allocate(sizeof(Node), alignof(Node))) Node();
         tail_ = head_;
-        free_head_ = new Node();
+        tail_cache_ = head_;
+        free_head_ = new (alloc_.allocate(sizeof(Node), alignof(Node))) Node();
         free_tail_ = free_head_;
+        free_tail_cache_ = free_head_;
+        recycled_ = 0;
+        taken_ = 0;
+        max_free_ = SIZE_MAX;
     }
 
-    SPSCQueueBase(SPSCQueueBase&&) = default;
+    BasicSPSCQueue(BasicSPSCQueue&&) = default;
 
     // Not thread-safe
-    ~SPSCQueueBase() {
+    ~BasicSPSCQueue() {
         while (head_ != nullptr) {
             Node* tmp = head_->next;
-            delete head_;
+            alloc_.deallocate(head_, sizeof(Node), alignof(Node));
+            if (tmp != nullptr) {
+                tmp->obj().~T();
+            }
             head_ = tmp;
         }
         while (free_head_ != nullptr) {
             Node* tmp = free_head_->next;
-            delete free_head_;
+            alloc_.deallocate(free_head_, sizeof(Node), alignof(Node));
             free_head_ = tmp;
         }
     }
 
     // Thread-safe for only one producer
-    void push(const T& obj) {
-        if (free_list_empty()) {
-            tail_->next = new Node(nullptr, obj);
-        } else {
-            tail_->next = free_head_;
-            free_head_ = free_head_->next;
-            new (tail_->next) Node(nullptr, obj);
+    // Wait by CapacityPolicy if the queue is full
+    // @return: false if the queue is full with Bounded<NoWait>
+    bool push(const T& obj) {
+        if (!wait_for_room()) {
+            return false;
         }
 
-        if (mode == 2) {
-            std::unique_lock<std::mutex> lk(mtx_);
-            // Atomic is still needed because empty() does not acquire the lock
-            __atomic_store(&tail_, &tail_->next, __ATOMIC_RELEASE);
-            lk.unlock();
-            cv_.notify_one();
-        } else {
-            __atomic_store(&tail_, &tail_->next, __ATOMIC_RELEASE);
+        Node* node = alloc_node();
+        new (node) Node(nullptr, obj);
+        tail_->next = node;
+        publish(node);
+        return true;
+    }
+
+    // Thread-safe for only one producer
+    // Wait by CapacityPolicy if the queue is full
+    // @return: false if the queue is full with Bounded<NoWait>
+    bool push(T&& obj) {
+        if (!wait_for_room()) {
+            return false;
         }
+
+        Node* node = alloc_node();
+        new (node) Node(nullptr, std::move(obj));
+        tail_->next = node;
+        publish(node);
+        return true;
     }
 
     // Thread-safe for only one producer
-    void push(T&& obj) {
-        if (free_list_empty()) {
-            tail_->next = new Node(nullptr, std::move(obj));
-        } else {
-            tail_->next = free_head_;
-            __atomic_store(&free_head_, &free_head_->next, __ATOMIC_RELEASE);
-            new (tail_->next) Node(nullptr, std::move(obj));
+    // Wait by CapacityPolicy if the queue is full
+    // @return: false if the queue is full with Bounded<NoWait>
+    template <typename... Args>
+    bool emplace(Args&&... args) {
+        if (!wait_for_room()) {
+            return false;
         }
 
-        if (mode == 2) {
-            std::unique_lock<std::mutex> lk(mtx_);
-            // Atomic is still needed because empty() does not acquire the lock
-            __atomic_store(&tail_, &tail_->next, __ATOMIC_RELEASE);
-            lk.unlock();
-            cv_.notify_one();
-        } else {
-            __atomic_store(&tail_, &tail_->next, __ATOMIC_RELEASE);
+        Node* node = alloc_node();
+        new (node) Node(nullptr, std::forward<Args>(args)...);
+        tail_->next = node;
+        publish(node);
+        return true;
+    }
+
+    // Thread-safe for only one producer
+    // Never wait
+    // @return: false if the queue is full
+    inline bool try_push(const T& obj) {
+        return !full() && push(obj);
+    }
+
+    // Thread-safe for only one producer
+    // Never wait
+    // @return: false if the queue is full
+    inline bool try_push(T&& obj) {
+        return !full() && push(std::move(obj));
+    }
+
+    // Thread-safe for only one producer
+    // Never wait
+    // @return: false if the queue is full
+    template <typename... Args>
+    inline bool try_emplace(Args&&... args) {
+        return !full() && emplace(std::forward<Args>(args)...);
+    }
+
+    // Thread-safe for only one producer
+    // Return a default-initialized element in the next node, so the producer can fill it in place without constructing
+    // and copying a temporary. It is not visible to the consumer until commit(). No other push is allowed in between
+    // Wait by CapacityPolicy if the queue is full. Return nullptr if the queue is full with Bounded<NoWait>
+    inline T* claim() {
+        if (!wait_for_room()) {
+            return nullptr;
+        }
+
+        Node* node = alloc_node();
+        new (&node->storage) T;
+        node->next = nullptr;
+        tail_->next = node;
+        return &node->obj();
+    }
+
+    // Thread-safe for only one producer
+    // Publish the element returned by claim()
+    inline void commit() {
+        publish(tail_->next);
+    }
+
+    // Thread-safe for only one producer
+    // Push [first, last). The consumer sees all of them at once, unless the queue becomes full in between
+    // @return: the number of elements pushed, which is less than the range only if the queue is full with
+    //          Bounded<NoWait>
+    template <typename InputIt>
+    size_t push_range(InputIt first, InputIt last) {
+        Node* back = tail_;
+        size_t n = 0;
+        for (; first != last; ++first) {
+            if (!room_for_next(back)) {
+                break;
+            }
+            Node* node = alloc_node();
+            new (node) Node(nullptr, *first);
+            back->next = node;
+            back = node;
+            ++n;
+        }
+        if (back != tail_) {
+            publish(back);
         }
+        return n;
     }
 
     // Thread-safe for only one producer
+    // Construct n elements from the same args. The consumer sees all of them at once, unless the queue becomes full in
+    // between
+    // @return: the number of elements pushed, which is less than n only if the queue is full with Bounded<NoWait>
     template <typename... Args>
-    void emplace(Args&&... args) {
-        if (free_list_empty()) {
-            tail_->next = new Node(nullptr, std::forward<Args>(args)...);
-        } else {
-            tail_->next = free_head_;
-            free_head_ = free_head_->next;
-            new (tail_->next) Node(nullptr, std::forward<Args>(args)...);
+    size_t emplace_n(size_t n, const Args&... args) {
+        Node* back = tail_;
+        size_t i = 0;
+        for (; i < n; ++i) {
+            if (!room_for_next(back)) {
+                break;
+            }
+            Node* node = alloc_node();
+            new (node) Node(nullptr, args...);
+            back->next = node;
+            back = node;
+        }
+        if (back != tail_) {
+            publish(back);
         }
+        return i;
+    }
+
+    // Thread-safe for only one producer
+    // Let the queue hold at most n elements. Ignored when Unbounded
+    inline void set_limit(size_t n) {
+        CapacityPolicy::set_limit(n);
+    }
 
-        if (mode == 2) {
-            std::unique_lock<std::mutex> lk(mtx_);
-            // Atomic is still needed because empty() does not acquire the lock
-            __atomic_store(&tail_, &tail_->next, __ATOMIC_RELEASE);
-            lk.unlock();
-            cv_.notify_one();
-        } else {
-            __atomic_store(&tail_, &tail_->next, __ATOMIC_RELEASE);
+    // Thread-safe for only one producer
+    // Always false when Unbounded
+    inline bool full() {
+        return CapacityPolicy::full(&recycled_);
+    }
+
+    // Thread-safe for only one producer
+    // Keep at most n nodes in the free list. The excess is released to the allocator when the producer next finds the
+    // free list used up. Unlimited by default
+    inline void set_max_free(size_t n) {
+        max_free_ = n;
+    }
+
+    // Thread-safe for only one producer
+    // Release nodes in the free list to the allocator until at most n are left. Nodes being recycled by the consumer
+    // concurrently may be left out
+    void shrink_to(size_t n) {
+        size_t num_free = refresh_free_list();
+        if (num_free > n) {
+            trim_free_list(num_free - n);
         }
     }
 
     // Thread-safe for only one consumer
     void pop() {
-        if (mode == 2 && empty()) {
-            std::unique_lock<std::mutex> lk(mtx_);
-            cv_.wait(lk, [&]{return !empty();});
-        } else if (mode == 1) {
-            while (empty());
+        wait();
+
+        recycle(head_->next);
+    }
+
+    // Thread-safe for only one consumer
+    // Move at most max elements to out and pop them. Wait by WaitPolicy until there is at least one element
+    // @return: the number of elements popped
+    template <typename OutputIt>
+    size_t pop_n(OutputIt out, size_t max) {
+        wait();
+
+        Node* tail = __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+        tail_cache_ = tail;
+        Node* node = head_;
+        size_t n = 0;
+        while (n < max && node != tail) {
+            node = node->next;
+            *out = std::move(node->obj());
+            ++out;
+            ++n;
         }
 
-        free_tail_->next = head_;
-        head_ = head_->next;
-        free_tail_->next->obj.~T();
-        free_tail_->next->next = nullptr;
-        __atomic_store(&free_tail_, &free_tail_->next, __ATOMIC_RELEASE);
+        if (n > 0) {
+            recycle(node);
+        }
+        return n;
     }
 
     // Thread-safe for only one consumer
-    inline T& front() {
-        if (mode == 2 && empty()) {
-            std::unique_lock<std::mutex> lk(mtx_);
-            cv_.wait(lk, [&]{return !empty();});
-        } else if (mode == 1) {
-            while (empty());
+    // Call fn(T&) on every element available now and pop them. Wait by WaitPolicy until there is at least one element
+    // @return: the number of elements popped
+    template <typename FuncT>
+    size_t consume_all(FuncT fn) {
+        wait();
+
+        return consume_available(fn);
+    }
+
+    inline int get_eventfd() const {
+        return NotifyPolicy::get_eventfd();
+    }
+
+    // EventFdNotify only. Thread-safe for only one consumer
+    // Clear get_eventfd() with a single read(), then call fn(T&) on every element and pop them until the queue stays
+    // empty after the consumer is marked idle. The next push() signals get_eventfd() again
+    // @return: the number of elements popped
+    template <typename FuncT>
+    size_t drain(FuncT fn) {
+        NotifyPolicy::clear();
+
+        size_t n = 0;
+        for (;;) {
+            n += consume_available(fn);
+
+            if (NotifyPolicy::rest([&]{return empty();})) {
+                return n;
+            }
         }
+    }
 
-        return head_->next->obj;
+    // Thread-safe for only one consumer
+    // Never wait. Return a view of all elements available now, to be processed in place and then popped by release()
+    inline View peek() {
+        Node* tail = __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+        tail_cache_ = tail;
+        return View(head_, tail);
+    }
+
+    // Thread-safe for only one consumer
+    // Pop the first n elements with a single publish to the free list. There must be at least n elements
+    void release(size_t n) {
+        if (n == 0) {
+            return;
+        }
+
+        Node* node = head_;
+        for (size_t i = 0; i < n; ++i) {
+            node = node->next;
+        }
+        recycle(node);
+    }
+
+    // Thread-safe for only one consumer
+    // Never wait
+    // @return: nullptr if the queue is empty
+    inline T* try_front() {
+        if (empty()) {
+            return nullptr;
+        }
+        return &head_->next->obj();
+    }
+
+    // Thread-safe for only one consumer
+    // Never wait. Move the front to obj and pop it
+    // @return: false if the queue is empty
+    bool try_pop(T& obj) {
+        if (empty()) {
+            return false;
+        }
+        obj = std::move(head_->next->obj());
+        recycle(head_->next);
+        return true;
+    }
+
+    // Thread-safe for only one consumer
+    // Wait until the queue is non-empty or deadline is reached, then move the front to obj and pop it.
+    // NoWait and SpinWait spin with cpu_relax(). AdaptiveWait may pass the deadline by its spinning stages
+    // @return: false on timeout
+    template <typename Clock, typename Duration>
+    bool pop_until(T& obj, const std::chrono::time_point<Clock, Duration>& deadline) {
+        if (!wait_until(deadline)) {
+            return false;
+        }
+        obj = std::move(head_->next->obj());
+        recycle(head_->next);
+        return true;
+    }
+
+    // Thread-safe for only one consumer
+    // Same as pop_until(obj, now + timeout)
+    template <typename Rep, typename Period>
+    inline bool pop_for(T& obj, const std::chrono::duration<Rep, Period>& timeout) {
+        return pop_until(obj, std::chrono::steady_clock::now() + timeout);
+    }
+
+    // Thread-safe for only one consumer
+    inline T& front() {
+        wait();
+
+        return head_->next->obj();
     }
 
     // Thread-safe for only one producer
+    // The producer must have pushed at least one element that is not yet popped
     inline T& back() {
-        return tail_->obj;
+        return tail_->obj();
     }
 
     // Thread-safe for only one consumer
-    // User of mode == 2 should be careful. It does NOT block.
+    // User of a blocking WaitPolicy other than SpinWait should be careful. It does NOT block.
     inline const T& front() const {
-        if (mode == 1) {
+        if (std::is_same<WaitPolicy, SpinWait>::value) {
             while (empty());
         }
-        return head_->next->obj;
+        return head_->next->obj();
     }
 
     // Thread-safe for only one producer
+    // The producer must have pushed at least one element that is not yet popped
     // TODO: it seems that this method does not make sense...
     inline const T& back() const {
-        return tail_->obj;
+        return tail_->obj();
     }
 
     // Thread-safe for only one consumer
     inline bool empty() const {
-        return head_ == __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+        if (head_ != tail_cache_) {
+            return false;
+        }
+        tail_cache_ = __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+        return head_ == tail_cache_;
     }
 
  private:
+    // The element lives in raw storage, so that the dummy head and the nodes in the free list do not hold one
     class Node {
      public:
-        Node() = default;
-        Node(Node* next, const T& obj) : obj(obj), next(next) {}
-        Node(Node* next, T&& obj) : obj(std::move(obj)), next(next) {}
+        Node() : next(nullptr) {}
         template <typename... Args>
-        Node(Node* next, Args&&... args) : obj(std::forward<Args>(args)...), next(next) {}
+        Node(Node* next, Args&&... args) : next(next) {
+            new (&storage) T(std::forward<Args>(args)...);
+        }
 
-        T obj;
+        inline T& obj() {
+            return *reinterpret_cast<T*>(&storage);
+        }
+
+        inline const T& obj() const {
+            return *reinterpret_cast<const T*>(&storage);
+        }
+
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
         Node* next;
     };
 
     // Thread-safe for only one producer
-    inline bool free_list_empty() const {
-        return free_head_ == __atomic_load_n(&free_tail_, __ATOMIC_ACQUIRE);
+    inline bool free_list_empty() {
+        if (free_head_ != free_tail_cache_) {
+            return false;
+        }
+        size_t num_free = refresh_free_list();
+        if (num_free > max_free_) {
+            trim_free_list(num_free - max_free_);
+        }
+        return free_head_ == free_tail_cache_;
+    }
+
+    // Thread-safe for only one producer
+    // @return: a lower bound of the number of nodes in [free_head_, free_tail_cache_)
+    inline size_t refresh_free_list() {
+        // Loading recycled_ first so that it is never ahead of free_tail_cache_
+        size_t recycled = __atomic_load_n(&recycled_, __ATOMIC_ACQUIRE);
+        free_tail_cache_ = __atomic_load_n(&free_tail_, __ATOMIC_ACQUIRE);
+        // recycled_ may still lag behind an earlier free_tail_cache_ whose nodes are already taken
+        return recycled > taken_ ? recycled - taken_ : 0;
+    }
+
+    // Thread-safe for only one producer
+    // Release the first n nodes of the free list to the allocator. Their elements are already destroyed
+    inline void trim_free_list(size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            Node* node = free_head_;
+            free_head_ = free_head_->next;
+            alloc_.deallocate(node, sizeof(Node), alignof(Node));
+        }
+        taken_ += n;
+    }
+
+    // Thread-safe for only one producer
+    // The returned node is not constructed
+    inline Node* alloc_node() {
+        CapacityPolicy::acquire(1);
+        if (free_list_empty()) {
+            return static_cast<Node*>(alloc_.allocate(sizeof(Node), alignof(Node)));
+        }
+        Node* node = free_head_;
+        free_head_ = free_head_->next;
+        ++taken_;
+        return node;
+    }
+
+    // Thread-safe for only one producer
+    // Wait by CapacityPolicy until the queue is not full
+    // @return: false if the queue is full with Bounded<NoWait>
+    inline bool wait_for_room() {
+        return !full() || CapacityPolicy::wait_room([&]{return !full();});
+    }
+
+    // Thread-safe for only one producer
+    // Same as wait_for_room(), but first publish the elements up to back that are linked but not yet visible, so that
+    // the consumer can make room
+    inline bool room_for_next(Node* back) {
+        if (!full()) {
+            return true;
+        }
+        if (back != tail_) {
+            publish(back);
+        }
+        return wait_for_room();
+    }
+
+    // Thread-safe for only one producer
+    // Make everything up to back visible to the consumer
+    inline void publish(Node* back) {
+        WaitPolicy::notify([&]{__atomic_store_n(&tail_, back, __ATOMIC_RELEASE);});
+        NotifyPolicy::notify();
+    }
+
+    // Thread-safe for only one consumer
+    inline void wait() {
+        WaitPolicy::wait([&]{return !empty();});
+    }
+
+    // Thread-safe for only one consumer
+    // @return: false on timeout
+    template <typename Clock, typename Duration>
+    inline bool wait_until(const std::chrono::time_point<Clock, Duration>& deadline) {
+        return WaitPolicy::wait_until([&]{return !empty();}, deadline);
+    }
+
+    // Thread-safe for only one consumer
+    // Call fn(T&) on every element available now and pop them
+    template <typename FuncT>
+    inline size_t consume_available(FuncT& fn) {
+        Node* tail = __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+        tail_cache_ = tail;
+        Node* node = head_;
+        size_t n = 0;
+        while (node != tail) {
+            node = node->next;
+            fn(node->obj());
+            ++n;
+        }
+
+        if (n > 0) {
+            recycle(node);
+        }
+        return n;
+    }
+
+    // Thread-safe for only one consumer
+    // Destroy the elements in (head_, new_head] and move the nodes in [head_, new_head) to the free list with a single
+    // publish. new_head becomes the dummy head
+    inline void recycle(Node* new_head) {
+        Node* node = head_;
+        free_tail_->next = node;
+        size_t n = 1;
+        for (;;) {
+            node->next->obj().~T();
+            if (node->next == new_head) {
+                break;
+            }
+            node = node->next;
+            ++n;
+        }
+        node->next = nullptr;
+        head_ = new_head;
+        __atomic_store_n(&free_tail_, node, __ATOMIC_RELEASE);
+        __atomic_store_n(&recycled_, recycled_ + n, __ATOMIC_RELEASE);
+        CapacityPolicy::release();
     }
     
-    Node* head_;
-    Node* tail_;
+    // Owned by the consumer
+    alignas(CACHE_LINE_SIZE) Node* head_;
+    mutable Node* tail_cache_;
+    Node* free_tail_;
+    size_t recycled_;
 
+    // Owned by the producer
+    alignas(CACHE_LINE_SIZE) Node* tail_;
     Node* free_head_;
-    Node* free_tail_;
+    Node* free_tail_cache_;
+    size_t taken_;
+    size_t max_free_;
+    Allocator alloc_;
+};
+
+// The policies of the integer modes
+// mode:
+//     - 0: wait-free
+//     - 1: wait by spinning
+//     - 2: wait by condition variable
+//     - 3: wait adaptively. Spin wait_spin_num times with pause, then yield wait_yield_num times, then sleep by futex
+//     - 5: wait-free, and signal get_eventfd() when the queue becomes non-empty. Consume with drain()
+//     - 6: wait by futex. The producer only pays a fence and a load when the consumer is not sleeping
+// limit_policy decides what a push does when the queue already holds set_limit() elements:
+//     - 0: no limit
+//     - 1: wait by spinning
+//     - 2: wait by futex
+//     - 3: fail and return false
+template <int mode, unsigned wait_spin_num = 1024, unsigned wait_yield_num = 16>
+struct ModeWaitPolicy {
+    typedef NoWait type;
+};
+
+template <unsigned wait_spin_num, unsigned wait_yield_num>
+struct ModeWaitPolicy<1, wait_spin_num, wait_yield_num> {
+    typedef SpinWait type;
+};
+
+template <unsigned wait_spin_num, unsigned wait_yield_num>
+struct ModeWaitPolicy<2, wait_spin_num, wait_yield_num> {
+    typedef CVWait type;
+};
+
+template <unsigned wait_spin_num, unsigned wait_yield_num>
+struct ModeWaitPolicy<3, wait_spin_num, wait_yield_num> {
+    typedef AdaptiveWait<wait_spin_num, wait_yield_num> type;
+};
+
+template <unsigned wait_spin_num, unsigned wait_yield_num>
+struct ModeWaitPolicy<6, wait_spin_num, wait_yield_num> {
+    typedef FutexWait type;
+};
+
+template <int mode>
+struct ModeNotifyPolicy {
+    typedef NoNotify type;
+};
 
-    std::mutex mtx_;
-    std::condition_variable cv_;
+template <>
+struct ModeNotifyPolicy<5> {
+    typedef EventFdNotify type;
 };
 
+template <int limit_policy>
+struct ModeCapacityPolicy {
+    typedef Unbounded type;
+};
+
+template <>
+struct ModeCapacityPolicy<1> {
+    typedef Bounded<SpinWait> type;
+};
+
+template <>
+struct ModeCapacityPolicy<2> {
+    typedef Bounded<FutexWait> type;
+};
+
+template <>
+struct ModeCapacityPolicy<3> {
+    typedef Bounded<NoWait> type;
+};
+
+template <typename T, int mode, unsigned wait_spin_num = 1024, unsigned wait_yield_num = 16,
+          typename Allocator = HeapAllocator, int limit_policy = 0>
+using SPSCQueueBase = BasicSPSCQueue<T, typename ModeWaitPolicy<mode, wait_spin_num, wait_yield_num>::type,
+                                     typename ModeNotifyPolicy<mode>::type, Allocator,
+                                     typename ModeCapacityPolicy<limit_policy>::type>;
+
 template <typename T>
 using SPSCQueue = SPSCQueueBase<T, 0>;
 
@@ -225,3 +744,12 @@ using SPSCQueueSpin = SPSCQueueBase<T, 1>;
 template <typename T>
 using SPSCQueueCV = SPSCQueueBase<T, 2>;
 
+template <typename T, unsigned wait_spin_num = 1024, unsigned wait_yield_num = 16>
+using SPSCQueueAdaptive = SPSCQueueBase<T, 3, wait_spin_num, wait_yield_num>;
+
+template <typename T>
+using SPSCQueueEventFd = SPSCQueueBase<T, 5>;
+
+template <typename T>
+using SPSCQueueFutex = SPSCQueueBase<T, 6>;
+
@@ -0,0 +1,271 @@
+/*
+ * SPSCRingQueue. A fixed-size queue which allows thread-safe manipulations in a single-producer single-consumer setting.
+ * Copyright (C) 2017  Kelvin Ng
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "spsc_queue.hpp"
+
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <utility>
+#include <atomic>
+#include <memory>
+#include <type_traits>
+#include <condition_variable>
+
+/*
+ * A fixed-size queue for single-consumer and single-producer setting. Elements are stored in a contiguous ring.
+ * capacity must be a power of two.
+ * mode:
+ *     - 0: wait-free
+ *     - 1: wait by spinning
+ *     - 2: wait by condition variable
+ * Only the consumer waits. push() and emplace() never wait and return false when the queue is full.
+ * For trivially copyable T, push_range() and pop_n() with pointers to T copy with at most two memcpy() calls, and no
+ * destructor is run.
+ */
+
+// Some guarantees:
+//  1. Thread-safe with single-consumer and single-producer
+//  2. head_ and tail_ only increase. The i-th element is stored in slots_[i & (capacity - 1)]
+//  3. Empty when head_ == tail_, full when tail_ - head_ == capacity
+//  4. Elements are never moved
+//  5. head_ is written only by the consumer, but is read by both the producer and consumer
+//  6. tail_ is written only by the producer, but is read by both the producer and consumer
+//  7. head_cache_ is read or written only by the producer. It is never ahead of head_
+//  8. tail_cache_ is read or written only by the consumer. It is never ahead of tail_, but may be behind head_
+//  9. The fields owned by the producer and the consumer are on different cache lines
+
+template <typename T, size_t capacity, int mode>
+class SPSCRingQueueBase {
+    static_assert(capacity > 0 && (capacity & (capacity - 1)) == 0, "capacity must be a power of two");
+
+ public:
+    // Not thread-safe
+    SPSCRingQueueBase() : slots_(new Slot[capacity]), head_(0), tail_cache_(0), tail_(0), head_cache_(0) {}
+
+    // Not thread-safe
+    ~SPSCRingQueueBase() {
+        if (!std::is_trivially_destructible<T>::value) {
+            while (head_ != tail_) {
+                slot(head_).~T();
+                ++head_;
+            }
+        }
+    }
+
+    // Thread-safe for only one producer
+    // Return false if the queue is full
+    inline bool push(const T& obj) {
+        return emplace(obj);
+    }
+
+    // Thread-safe for only one producer
+    // Return false if the queue is full
+    inline bool push(T&& obj) {
+        return emplace(std::move(obj));
+    }
+
+    // Thread-safe for only one producer
+    // Return false if the queue is full
+    template <typename... Args>
+    bool emplace(Args&&... args) {
+        if (full()) {
+            return false;
+        }
+
+        new (&slot(tail_)) T(std::forward<Args>(args)...);
+        publish(tail_ + 1);
+
+        return true;
+    }
+
+    // Thread-safe for only one producer
+    // Push as many elements of [first, last) as there is room for. The consumer sees all of them at once
+    // @return: the number of elements pushed
+    template <typename InputIt>
+    size_t push_range(InputIt first, InputIt last) {
+        head_cache_ = __atomic_load_n(&head_, __ATOMIC_ACQUIRE);
+        size_t n = construct_range(first, last, capacity - (tail_ - head_cache_), is_bulk_copyable<InputIt>());
+        if (n > 0) {
+            publish(tail_ + n);
+        }
+        return n;
+    }
+
+    // Thread-safe for only one consumer
+    void pop() {
+        wait();
+
+        slot(head_).~T();
+        __atomic_store_n(&head_, head_ + 1, __ATOMIC_RELEASE);
+    }
+
+    // Thread-safe for only one consumer
+    // Move at most max elements to out and pop them. Wait according to mode until there is at least one element
+    // @return: the number of elements popped
+    template <typename OutputIt>
+    size_t pop_n(OutputIt out, size_t max) {
+        wait();
+
+        tail_cache_ = __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+        size_t n = move_out(out, std::min(max, tail_cache_ - head_), is_bulk_copyable<OutputIt>());
+        __atomic_store_n(&head_, head_ + n, __ATOMIC_RELEASE);
+        return n;
+    }
+
+    // Thread-safe for only one consumer
+    inline T& front() {
+        wait();
+
+        return slot(head_);
+    }
+
+    // Thread-safe for only one consumer
+    // User of mode == 2 should be careful. It does NOT block.
+    inline const T& front() const {
+        if (mode == 1) {
+            while (empty());
+        }
+        return slot(head_);
+    }
+
+    // Thread-safe for only one producer
+    // The producer must have pushed at least one element that is not yet popped
+    inline T& back() {
+        return slot(tail_ - 1);
+    }
+
+    // Thread-safe for only one consumer
+    inline bool empty() const {
+        // head_ may pass tail_cache_ in mode 0, where pop() and front() do not wait
+        if (head_ < tail_cache_) {
+            return false;
+        }
+        tail_cache_ = __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+        return head_ == tail_cache_;
+    }
+
+    // Thread-safe for only one producer
+    inline bool full() const {
+        if (tail_ - head_cache_ != capacity) {
+            return false;
+        }
+        head_cache_ = __atomic_load_n(&head_, __ATOMIC_ACQUIRE);
+        return tail_ - head_cache_ == capacity;
+    }
+
+ private:
+    typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Slot;
+
+    // Whether elements can be copied between It and the slots by memcpy()
+    template <typename It>
+    using is_bulk_copyable = std::integral_constant<bool, std::is_trivially_copyable<T>::value &&
+        (std::is_same<It, T*>::value || std::is_same<It, const T*>::value)>;
+
+    inline T& slot(size_t idx) const {
+        return *reinterpret_cast<T*>(&slots_[idx & (capacity - 1)]);
+    }
+
+    // Thread-safe for only one producer
+    inline void publish(size_t tail) {
+        if (mode == 2) {
+            std::unique_lock<std::mutex> lk(mtx_);
+            // Atomic is still needed because empty() does not acquire the lock
+            __atomic_store_n(&tail_, tail, __ATOMIC_RELEASE);
+            lk.unlock();
+            cv_.notify_one();
+        } else {
+            __atomic_store_n(&tail_, tail, __ATOMIC_RELEASE);
+        }
+    }
+
+    // Thread-safe for only one consumer
+    inline void wait() {
+        if (mode == 2 && empty()) {
+            std::unique_lock<std::mutex> lk(mtx_);
+            cv_.wait(lk, [&]{return !empty();});
+        } else if (mode == 1) {
+            while (empty());
+        }
+    }
+
+    // Thread-safe for only one producer
+    // Construct at most max elements of [first, last) from tail_ without publishing them
+    template <typename InputIt>
+    inline size_t construct_range(InputIt first, InputIt last, size_t max, std::false_type) {
+        size_t n = 0;
+        for (; n < max && first != last; ++first, ++n) {
+            new (&slot(tail_ + n)) T(*first);
+        }
+        return n;
+    }
+
+    template <typename InputIt>
+    inline size_t construct_range(InputIt first, InputIt last, size_t max, std::true_type) {
+        size_t n = std::min(max, (size_t)(last - first));
+        size_t idx = tail_ & (capacity - 1);
+        size_t part = std::min(n, capacity - idx);
+        std::memcpy(&slots_[idx], first, part * sizeof(T));
+        std::memcpy(&slots_[0], first + part, (n - part) * sizeof(T));
+        return n;
+    }
+
+    // Thread-safe for only one consumer
+    // Move n elements from head_ to out and destroy them without popping them
+    template <typename OutputIt>
+    inline size_t move_out(OutputIt out, size_t n, std::false_type) {
+        for (size_t i = 0; i < n; ++i, ++out) {
+            *out = std::move(slot(head_ + i));
+            slot(head_ + i).~T();
+        }
+        return n;
+    }
+
+    template <typename OutputIt>
+    inline size_t move_out(OutputIt out, size_t n, std::true_type) {
+        size_t idx = head_ & (capacity - 1);
+        size_t part = std::min(n, capacity - idx);
+        std::memcpy(out, &slots_[idx], part * sizeof(T));
+        std::memcpy(out + part, &slots_[0], (n - part) * sizeof(T));
+        return n;
+    }
+
+    std::unique_ptr<Slot[]> slots_;
+
+    // Owned by the consumer
+    alignas(CACHE_LINE_SIZE) size_t head_;
+    mutable size_t tail_cache_;
+
+    // Owned by the producer
+    alignas(CACHE_LINE_SIZE) size_t tail_;
+    mutable size_t head_cache_;
+
+    alignas(CACHE_LINE_SIZE) std::mutex mtx_;
+    std::condition_variable cv_;
+};
+
+template <typename T, size_t capacity>
+using SPSCRingQueue = SPSCRingQueueBase<T, capacity, 0>;
+
+template <typename T, size_t capacity>
+using SPSCRingQueueSpin = SPSCRingQueueBase<T, capacity, 1>;
+
+template <typename T, size_t capacity>
+using SPSCRingQueueCV = SPSCRingQueueBase<T, capacity, 2>;
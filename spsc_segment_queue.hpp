@@ -0,0 +1,436 @@
+/*
+ * SPSCSegmentQueue. An infinite-size queue which allows thread-safe manipulations in a single-producer single-consumer setting.
+ * Copyright (C) 2017  Kelvin Ng
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "spsc_queue.hpp"
+
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <utility>
+#include <atomic>
+#include <type_traits>
+#include <condition_variable>
+
+/*
+ * A queue for single-consumer and single-producer setting. Each node is a segment of segment_size elements, so
+ * allocations are cut by segment_size times and elements in the same segment are contiguous.
+ * mode:
+ *     - 0: wait-free
+ *     - 1: wait by spinning
+ *     - 2: wait by condition variable
+ * For trivially copyable T, push_range() and pop_n() with pointers to T copy a segment at a time with memcpy(), and no
+ * destructor is run.
+ */
+
+// Some guarantees:
+//  1. Thread-safe with single-consumer and single-producer
+//  2. There is always at least one segment
+//  3. head_ and tail_ count the elements ever popped and pushed. Empty when head_ == tail_
+//  4. The front is head_seg_->slots[head_idx_], or the first slot of head_seg_->next if head_idx_ == segment_size
+//  5. The back is tail_seg_->slots[tail_idx_ - 1]
+//  6. Elements are never moved
+//  7. head_seg_, head_idx_ and head_ are read or written only by the consumer
+//  8. tail_ is written only by the producer, but is read by both the producer and consumer
+//  9. tail_seg_ and tail_idx_ are read or written only by the producer
+// 10. tail_seg_->next is written before the first element in the next segment is published
+// 11. free_head_ is read or written only by the producer
+// 12. free_tail_ is written only by the consumer, but is read by both the producer and consumer
+// 13. tail_cache_ and free_tail_cache_ are possibly outdated copies of tail_ and free_tail_, owned by the consumer and producer respectively.
+//     tail_cache_ may be behind head_
+// 14. The fields owned by the producer and the consumer are on different cache lines
+
+template <typename T, int mode, size_t segment_size = 64>
+class SPSCSegmentQueueBase {
+    static_assert(segment_size > 0, "segment_size must be positive");
+    static_assert(mode == 0 || mode == 1 || mode == 2, "mode must be 0, 1 or 2");
+
+ public:
+    // Not thread-safe
+    SPSCSegmentQueueBase() {
+        head_seg_ = new Segment();
+        head_idx_ = 0;
+        head_ = 0;
+        tail_cache_ = 0;
+        tail_seg_ = head_seg_;
+        tail_idx_ = 0;
+        tail_ = 0;
+
+        free_head_ = new Segment();
+        free_tail_ = free_head_;
+        free_tail_cache_ = free_head_;
+    }
+
+    // Not thread-safe
+    ~SPSCSegmentQueueBase() {
+        if (!std::is_trivially_destructible<T>::value) {
+            while (head_ != tail_) {
+                pop();
+            }
+        }
+        while (head_seg_ != nullptr) {
+            Segment* tmp = head_seg_->next;
+            delete head_seg_;
+            head_seg_ = tmp;
+        }
+        while (free_head_ != nullptr) {
+            Segment* tmp = free_head_->next;
+            delete free_head_;
+            free_head_ = tmp;
+        }
+    }
+
+    // Thread-safe for only one producer
+    // @return: always true, since the queue is unbounded
+    inline bool push(const T& obj) {
+        return emplace(obj);
+    }
+
+    // Thread-safe for only one producer
+    // @return: always true, since the queue is unbounded
+    inline bool push(T&& obj) {
+        return emplace(std::move(obj));
+    }
+
+    // Thread-safe for only one producer
+    // @return: always true, since the queue is unbounded
+    template <typename... Args>
+    bool emplace(Args&&... args) {
+        if (tail_idx_ == segment_size) {
+            next_tail_segment();
+        }
+
+        new (&tail_seg_->slot(tail_idx_)) T(std::forward<Args>(args)...);
+        ++tail_idx_;
+
+        publish(tail_ + 1);
+
+        return true;
+    }
+
+    // Thread-safe for only one producer
+    // Same as push(obj), for the same API as SPSCQueueBase
+    inline bool try_push(const T& obj) {
+        return emplace(obj);
+    }
+
+    // Thread-safe for only one producer
+    // Same as push(obj), for the same API as SPSCQueueBase
+    inline bool try_push(T&& obj) {
+        return emplace(std::move(obj));
+    }
+
+    // Thread-safe for only one producer
+    // Same as emplace(args...), for the same API as SPSCQueueBase
+    template <typename... Args>
+    inline bool try_emplace(Args&&... args) {
+        return emplace(std::forward<Args>(args)...);
+    }
+
+    // Thread-safe for only one producer
+    // Push [first, last). The consumer sees all of them at once
+    // @return: the number of elements pushed
+    template <typename InputIt>
+    size_t push_range(InputIt first, InputIt last) {
+        size_t n = construct_range(first, last, is_bulk_copyable<InputIt>());
+        if (n > 0) {
+            publish(tail_ + n);
+        }
+        return n;
+    }
+
+    // Thread-safe for only one consumer
+    void pop() {
+        T& obj = front();
+        obj.~T();
+        ++head_idx_;
+        ++head_;
+    }
+
+    // Thread-safe for only one consumer
+    // Move at most max elements to out and pop them. Wait according to mode until there is at least one element
+    // @return: the number of elements popped
+    template <typename OutputIt>
+    size_t pop_n(OutputIt out, size_t max) {
+        wait();
+
+        tail_cache_ = __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+        size_t n = std::min(max, tail_cache_ - head_);
+        size_t left = n;
+        while (left > 0) {
+            if (head_idx_ == segment_size) {
+                next_segment();
+            }
+            size_t part = std::min(left, segment_size - head_idx_);
+            out = move_out(out, part, is_bulk_copyable<OutputIt>());
+            head_idx_ += part;
+            left -= part;
+        }
+        head_ += n;
+        return n;
+    }
+
+    // Thread-safe for only one consumer
+    inline T& front() {
+        wait();
+
+        if (head_idx_ == segment_size) {
+            next_segment();
+        }
+        return head_seg_->slot(head_idx_);
+    }
+
+    // Thread-safe for only one producer
+    // The queue must not be empty
+    inline T& back() {
+        return tail_seg_->slot(tail_idx_ - 1);
+    }
+
+    // Thread-safe for only one consumer
+    // Never wait
+    // @return: nullptr if the queue is empty
+    inline T* try_front() {
+        if (empty()) {
+            return nullptr;
+        }
+        if (head_idx_ == segment_size) {
+            next_segment();
+        }
+        return &head_seg_->slot(head_idx_);
+    }
+
+    // Thread-safe for only one consumer
+    // Never wait. Move the front to obj and pop it
+    // @return: false if the queue is empty
+    bool try_pop(T& obj) {
+        T* front = try_front();
+        if (front == nullptr) {
+            return false;
+        }
+        obj = std::move(*front);
+        front->~T();
+        ++head_idx_;
+        ++head_;
+        return true;
+    }
+
+    // Thread-safe for only one consumer
+    inline bool empty() const {
+        // head_ may pass tail_cache_ in mode 0, where pop() and front() do not wait
+        if (head_ < tail_cache_) {
+            return false;
+        }
+        tail_cache_ = __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+        return head_ == tail_cache_;
+    }
+
+ private:
+    // Whether elements can be copied between It and the slots by memcpy()
+    template <typename It>
+    using is_bulk_copyable = std::integral_constant<bool, std::is_trivially_copyable<T>::value &&
+        (std::is_same<It, T*>::value || std::is_same<It, const T*>::value)>;
+
+    class Segment {
+     public:
+        inline T& slot(size_t idx) {
+            return *reinterpret_cast<T*>(&slots[idx]);
+        }
+
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type slots[segment_size];
+        Segment* next = nullptr;
+    };
+
+    // Thread-safe for only one producer
+    inline bool free_list_empty() {
+        if (free_head_ != free_tail_cache_) {
+            return false;
+        }
+        free_tail_cache_ = __atomic_load_n(&free_tail_, __ATOMIC_ACQUIRE);
+        return free_head_ == free_tail_cache_;
+    }
+
+    // Thread-safe for only one producer
+    inline Segment* alloc_segment() {
+        if (free_list_empty()) {
+            return new Segment();
+        }
+        Segment* seg = free_head_;
+        free_head_ = free_head_->next;
+        seg->next = nullptr;
+        return seg;
+    }
+
+    // Thread-safe for only one producer
+    inline void publish(size_t tail) {
+        if (mode == 2) {
+            std::unique_lock<std::mutex> lk(mtx_);
+            // Atomic is still needed because empty() does not acquire the lock
+            __atomic_store_n(&tail_, tail, __ATOMIC_RELEASE);
+            lk.unlock();
+            cv_.notify_one();
+        } else {
+            __atomic_store_n(&tail_, tail, __ATOMIC_RELEASE);
+        }
+    }
+
+    // Thread-safe for only one consumer
+    inline void wait() {
+        if (mode == 2 && empty()) {
+            std::unique_lock<std::mutex> lk(mtx_);
+            cv_.wait(lk, [&]{return !empty();});
+        } else if (mode == 1) {
+            while (empty());
+        }
+    }
+
+    // Thread-safe for only one producer
+    inline void next_tail_segment() {
+        Segment* seg = alloc_segment();
+        tail_seg_->next = seg;
+        tail_seg_ = seg;
+        tail_idx_ = 0;
+    }
+
+    // Thread-safe for only one producer
+    // Construct [first, last) after the back without publishing them
+    template <typename InputIt>
+    inline size_t construct_range(InputIt first, InputIt last, std::false_type) {
+        size_t n = 0;
+        for (; first != last; ++first, ++n) {
+            if (tail_idx_ == segment_size) {
+                next_tail_segment();
+            }
+            new (&tail_seg_->slot(tail_idx_)) T(*first);
+            ++tail_idx_;
+        }
+        return n;
+    }
+
+    template <typename InputIt>
+    inline size_t construct_range(InputIt first, InputIt last, std::true_type) {
+        size_t n = last - first;
+        while (first != last) {
+            if (tail_idx_ == segment_size) {
+                next_tail_segment();
+            }
+            size_t part = std::min((size_t)(last - first), segment_size - tail_idx_);
+            std::memcpy(&tail_seg_->slots[tail_idx_], first, part * sizeof(T));
+            tail_idx_ += part;
+            first += part;
+        }
+        return n;
+    }
+
+    // Thread-safe for only one consumer
+    // Move n elements in head_seg_ from head_idx_ to out and destroy them without popping them
+    // @return: out after the elements
+    template <typename OutputIt>
+    inline OutputIt move_out(OutputIt out, size_t n, std::false_type) {
+        for (size_t i = head_idx_; i < head_idx_ + n; ++i, ++out) {
+            *out = std::move(head_seg_->slot(i));
+            head_seg_->slot(i).~T();
+        }
+        return out;
+    }
+
+    template <typename OutputIt>
+    inline OutputIt move_out(OutputIt out, size_t n, std::true_type) {
+        std::memcpy(out, &head_seg_->slots[head_idx_], n * sizeof(T));
+        return out + n;
+    }
+
+    // Thread-safe for only one consumer
+    // Move to the next segment and recycle the current one. The queue must not be empty
+    inline void next_segment() {
+        Segment* seg = head_seg_;
+        head_seg_ = seg->next;
+        head_idx_ = 0;
+
+        seg->next = nullptr;
+        free_tail_->next = seg;
+        __atomic_store_n(&free_tail_, seg, __ATOMIC_RELEASE);
+    }
+
+    // Owned by the consumer
+    alignas(CACHE_LINE_SIZE) Segment* head_seg_;
+    size_t head_idx_;
+    size_t head_;
+    mutable size_t tail_cache_;
+    Segment* free_tail_;
+
+    // Owned by the producer
+    alignas(CACHE_LINE_SIZE) Segment* tail_seg_;
+    size_t tail_idx_;
+    size_t tail_;
+    Segment* free_head_;
+    Segment* free_tail_cache_;
+
+    alignas(CACHE_LINE_SIZE) std::mutex mtx_;
+    std::condition_variable cv_;
+};
+
+template <typename T, size_t segment_size = 64>
+using SPSCSegmentQueue = SPSCSegmentQueueBase<T, 0, segment_size>;
+
+template <typename T, size_t segment_size = 64>
+using SPSCSegmentQueueSpin = SPSCSegmentQueueBase<T, 1, segment_size>;
+
+template <typename T, size_t segment_size = 64>
+using SPSCSegmentQueueCV = SPSCSegmentQueueBase<T, 2, segment_size>;
+
+// SPSCSegmentQueueBase for small trivially copyable T, which keeps elements inline and copies them in bulk, and
+// SPSCQueueBase otherwise. Only mode 0, 1 and 2 are supported. Both expose the same API: push(), emplace(), try_push(),
+// try_emplace(), push_range(), pop(), pop_n(), try_pop(), front(), try_front(), back() and empty()
+template <typename T, int mode>
+class SPSCQueueAuto : private std::conditional<std::is_trivially_copyable<T>::value && sizeof(T) <= 64,
+                                               SPSCSegmentQueueBase<T, mode>, SPSCQueueBase<T, mode>>::type {
+    static_assert(mode == 0 || mode == 1 || mode == 2, "mode must be 0, 1 or 2");
+
+    typedef typename std::conditional<std::is_trivially_copyable<T>::value && sizeof(T) <= 64,
+                                      SPSCSegmentQueueBase<T, mode>, SPSCQueueBase<T, mode>>::type Base;
+
+ public:
+    using Base::push;
+    using Base::emplace;
+    using Base::try_push;
+    using Base::try_emplace;
+    using Base::push_range;
+    using Base::pop;
+    using Base::pop_n;
+    using Base::try_pop;
+    using Base::empty;
+
+    // Thread-safe for only one consumer
+    inline T& front() {
+        return Base::front();
+    }
+
+    // Thread-safe for only one consumer
+    // Never wait
+    // @return: nullptr if the queue is empty
+    inline T* try_front() {
+        return Base::try_front();
+    }
+
+    // Thread-safe for only one producer
+    // The queue must not be empty
+    inline T& back() {
+        return Base::back();
+    }
+};
@@ -0,0 +1,114 @@
+// g++ -std=c++14 -O2 -pthread test/broadcast_ring_test.cpp -o broadcast_ring_test && ./broadcast_ring_test
+
+#undef NDEBUG
+
+#include "../broadcast_ring.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// Trivially copyable, but not default-constructible
+class Msg {
+ public:
+    explicit Msg(long v) : v(v) {}
+
+    long v;
+};
+
+static void test_max_readers() {
+    BroadcastRingBase<Msg, 4, 0, 0, 2> ring;
+    ring.add_reader();
+    ring.add_reader();
+    bool thrown = false;
+    try {
+        ring.add_reader();
+    } catch (const std::length_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+// Under policy 0, the producer waits for the slowest active reader, and stops waiting for it once it detaches
+static void test_wait_for_slowest() {
+    BroadcastRing<Msg, 4, 0> ring;
+    auto fast = ring.add_reader();
+    auto slow = ring.add_reader();
+    Msg m(0);
+    for (long i = 0; i < 4; ++i) {
+        assert(ring.push(Msg(i)));
+        assert(fast.try_read(m) && m.v == i);
+    }
+    assert(!ring.push(Msg(4)));
+    assert(ring.max_lag() == 4);
+    assert(slow.try_read(m) && m.v == 0);
+    assert(ring.push(Msg(4)));
+    assert(!ring.push(Msg(5)));
+    slow.detach();
+    assert(ring.push(Msg(5)));
+    for (long i = 4; i < 6; ++i) {
+        assert(fast.try_read(m) && m.v == i);
+    }
+    assert(!fast.try_read(m));
+    assert(fast.dropped() == 0);
+}
+
+// Under policy 1, a reader that falls behind skips to the oldest message in the ring and counts what it missed
+static void test_overwrite() {
+    BroadcastRing<Msg, 4, 1> ring;
+    auto reader = ring.add_reader();
+    for (long i = 0; i < 10; ++i) {
+        assert(ring.push(Msg(i)));
+    }
+    Msg m(0);
+    for (long i = 6; i < 10; ++i) {
+        assert(reader.try_read(m) && m.v == i);
+    }
+    assert(!reader.try_read(m));
+    assert(reader.dropped() == 6);
+
+    // A reader registered later only sees what is pushed after it
+    auto late = ring.add_reader();
+    assert(!late.try_read(m));
+    ring.push(Msg(10));
+    assert(late.try_read(m) && m.v == 10);
+}
+
+// Every reader sees every message in order
+template <typename Ring>
+static void test_threads() {
+    const long n = 20000;
+    const int num_readers = 3;
+    Ring ring;
+    std::vector<typename Ring::Reader> readers;
+    for (int k = 0; k < num_readers; ++k) {
+        readers.push_back(ring.add_reader());
+    }
+    std::vector<std::thread> threads;
+    for (int k = 0; k < num_readers; ++k) {
+        threads.emplace_back([&, k] {
+            Msg m(0);
+            for (long i = 0; i < n; ++i) {
+                assert(readers[k].read(m) && m.v == i);
+            }
+        });
+    }
+    for (long i = 0; i < n; ++i) {
+        while (!ring.push(Msg(i))) {}
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+int main() {
+    test_max_readers();
+    test_wait_for_slowest();
+    test_overwrite();
+    test_threads<BroadcastRingSpin<Msg, 64>>();
+    test_threads<BroadcastRingCV<Msg, 64>>();
+    test_threads<BroadcastRingFutex<Msg, 64>>();
+    std::puts("ok");
+}
@@ -0,0 +1,142 @@
+// g++ -std=c++14 -O2 -pthread test/mpmc_queue_test.cpp -o mpmc_queue_test && ./mpmc_queue_test
+
+#undef NDEBUG
+
+#include "../mpmc_queue.hpp"
+
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A range is pushed as far as there is room, and a batch pop takes as many as are there
+static void test_single_thread() {
+    MPMCQueue<std::string, 4> q;
+    std::string s;
+    std::string out[6];
+    assert(q.empty());
+    assert(!q.try_pop(s));
+    assert(q.try_pop_n(out, 6) == 0);
+    assert(q.pop_n(out, 6) == 0);
+
+    std::string items[] = {"a", "b", "c", "d", "e", "f"};
+    assert(q.push_range(items, items) == 0);
+    assert(q.push_range(items, items + 6) == 4);
+    assert(!q.push("x"));
+    assert(q.try_pop(s) && s == "a");
+    assert(q.push_range(items + 4, items + 6) == 1);
+    assert(q.try_pop_n(out, 6) == 4);
+    assert(out[0] == "b" && out[1] == "c" && out[2] == "d" && out[3] == "e");
+    assert(q.empty());
+
+    q.emplace(100, 'y');
+    assert(q.pop_for(s, std::chrono::seconds(0)) && s == std::string(100, 'y'));
+    q.emplace(100, 'z');
+}
+
+static void test_timed_pop() {
+    using namespace std::chrono;
+    MPMCQueueFutex<int, 16> q;
+    int v;
+    auto start = steady_clock::now();
+    assert(!q.pop_for(v, milliseconds(20)));
+    assert(steady_clock::now() - start >= milliseconds(20));
+    q.push(1);
+    assert(q.pop_for(v, milliseconds(20)) && v == 1);
+}
+
+// Every element is taken exactly once, and each consumer sees the elements of each producer in order. Producers push
+// single elements and ranges, and consumers pop single elements and batches
+template <typename Q>
+static void test_threads() {
+    const int n = 8000;
+    const int num_producers = 3;
+    const int num_consumers = 3;
+    Q q;
+    std::vector<int> taken(num_producers * n, 0);
+    std::atomic<int> exited(0);
+    std::vector<std::thread> consumers;
+    for (int c = 0; c < num_consumers; ++c) {
+        consumers.emplace_back([&, c] {
+            std::vector<int> last(num_producers, -1);
+            int buf[8];
+            for (;;) {
+                size_t got = c % 2 == 0 ? q.pop_n(buf, 8) : q.pop(buf[0]);
+                if (got == 0) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                bool stop = false;
+                for (size_t k = 0; k < got; ++k) {
+                    int v = buf[k];
+                    if (v < 0) {
+                        stop = true;
+                        continue;
+                    }
+                    assert(v % n > last[v / n]);
+                    last[v / n] = v % n;
+                    ++taken[v];
+                }
+                if (stop) {
+                    ++exited;
+                    return;
+                }
+            }
+        });
+    }
+    std::vector<std::thread> producers;
+    for (int p = 0; p < num_producers; ++p) {
+        producers.emplace_back([&, p] {
+            for (int i = 0; i < n; i += 4) {
+                int items[] = {p * n + i, p * n + i + 1, p * n + i + 2, p * n + i + 3};
+                if (i % 8 == 0) {
+                    size_t pushed = 0;
+                    while (pushed < 4) {
+                        size_t k = q.push_range(items + pushed, items + 4);
+                        if (k == 0) {
+                            std::this_thread::yield();
+                        }
+                        pushed += k;
+                    }
+                } else {
+                    for (int v : items) {
+                        while (!q.push(v)) {
+                            std::this_thread::yield();
+                        }
+                    }
+                }
+                if (i % 1000 == 0) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+            }
+        });
+    }
+    for (auto& t : producers) {
+        t.join();
+    }
+    // A batch may take several stops, so keep pushing until every consumer has one
+    while (exited < num_consumers) {
+        q.push(-1);
+        std::this_thread::yield();
+    }
+    for (auto& t : consumers) {
+        t.join();
+    }
+    for (int v : taken) {
+        assert(v == 1);
+    }
+}
+
+int main() {
+    test_single_thread();
+    test_timed_pop();
+    test_threads<MPMCQueue<int, 16>>();
+    test_threads<MPMCQueueSpin<int, 16>>();
+    test_threads<MPMCQueueCV<int, 16>>();
+    test_threads<MPMCQueueBase<int, 16, 3>>();
+    test_threads<MPMCQueueFutex<int, 16>>();
+    std::puts("ok");
+}
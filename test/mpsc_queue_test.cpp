@@ -0,0 +1,94 @@
+// g++ -std=c++14 -O2 -pthread test/mpsc_queue_test.cpp -o mpsc_queue_test && ./mpsc_queue_test
+
+#undef NDEBUG
+
+#include "../mpsc_queue.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+static void test_max_producers() {
+    MPSCQueue<int, 2> q;
+    q.add_producer();
+    q.add_producer();
+    bool thrown = false;
+    try {
+        q.add_producer();
+    } catch (const std::length_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+// The consumer goes round the lanes, and each lane keeps its order
+static void test_single_thread() {
+    MPSCQueue<int> q;
+    assert(q.empty());
+    auto a = q.add_producer();
+    auto b = q.add_producer();
+    a.push(1);
+    a.push(2);
+    b.emplace(10);
+    int v;
+    assert(q.try_pop(v) && v == 1);
+    assert(q.front() == 10);
+    q.pop();
+    assert(q.try_pop(v) && v == 2);
+    assert(!q.try_pop(v));
+    assert(q.empty());
+
+    int items[] = {3, 4, 5};
+    a.push_range(items, items + 3);
+    b.push(11);
+    int sum = 0;
+    assert(q.consume_all([&](int& x) { sum += x; }) == 4);
+    assert(sum == 3 + 4 + 5 + 11);
+    assert(q.empty());
+}
+
+// Every element arrives, in order within each producer. Producers pause now and then, so that a waiting consumer
+// goes to sleep and must be woken
+template <typename Q>
+static void test_threads() {
+    const int n = 20000;
+    const int num_producers = 3;
+    Q q;
+    std::vector<std::thread> producers;
+    for (int k = 0; k < num_producers; ++k) {
+        auto producer = q.add_producer();
+        producers.emplace_back([=]() mutable {
+            for (int i = 0; i < n; ++i) {
+                producer.push(k * n + i);
+                if (i % 1000 == 0) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+            }
+        });
+    }
+    std::vector<int> next(num_producers, 0);
+    for (int i = 0; i < num_producers * n; ++i) {
+        int v = q.front();
+        q.pop();
+        int k = v / n;
+        assert(v % n == next[k]);
+        ++next[k];
+    }
+    for (auto& t : producers) {
+        t.join();
+    }
+    assert(q.empty());
+}
+
+int main() {
+    test_max_producers();
+    test_single_thread();
+    test_threads<MPSCQueueSpin<int>>();
+    test_threads<MPSCQueueCV<int>>();
+    test_threads<MPSCQueueBase<int, 3>>();
+    test_threads<MPSCQueueFutex<int>>();
+    std::puts("ok");
+}
@@ -0,0 +1,116 @@
+// g++ -std=c++14 -O2 -pthread test/node_allocator_test.cpp -o node_allocator_test && ./node_allocator_test
+
+#undef NDEBUG
+
+#include "../node_allocator.hpp"
+#include "../spsc_queue.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <new>
+#include <thread>
+#include <vector>
+
+static inline bool aligned(void* ptr, size_t align) {
+    return reinterpret_cast<uintptr_t>(ptr) % align == 0;
+}
+
+template <typename Allocator>
+static bool throws_bad_alloc(Allocator& alloc, size_t size, size_t align) {
+    try {
+        alloc.allocate(size, align);
+    } catch (const std::bad_alloc&) {
+        return true;
+    }
+    return false;
+}
+
+static void test_heap() {
+    HeapAllocator alloc;
+    for (size_t align : {8, 16, 64, 128, 4096}) {
+        std::vector<void*> ptrs;
+        for (int i = 0; i < 100; ++i) {
+            void* ptr = alloc.allocate(24, align);
+            assert(aligned(ptr, align));
+            ptrs.push_back(ptr);
+        }
+        for (void* ptr : ptrs) {
+            alloc.deallocate(ptr, 24, align);
+        }
+    }
+}
+
+// Slots are reused last in first out, new slots follow each other, and a new chunk is mapped when one is used up
+static void test_slab() {
+    SlabAllocator<4096> alloc;
+    void* a = alloc.allocate(40, 64);
+    void* b = alloc.allocate(40, 64);
+    assert(aligned(a, 64) && aligned(b, 64));
+    assert(static_cast<char*>(b) - static_cast<char*>(a) == 64);
+    alloc.deallocate(a, 40, 64);
+    alloc.deallocate(b, 40, 64);
+    assert(alloc.allocate(40, 64) == b);
+    assert(alloc.allocate(40, 64) == a);
+    for (int i = 0; i < 200; ++i) {
+        assert(aligned(alloc.allocate(40, 64), 64));
+    }
+
+    // Every allocation must have the slot size
+    assert(throws_bad_alloc(alloc, 100, 64));
+
+    // A slot must fit in a chunk
+    SlabAllocator<4096> small;
+    assert(throws_bad_alloc(small, 4096, 8));
+    assert(small.allocate(64, 8) != nullptr);
+}
+
+static void test_arena() {
+    ArenaAllocator<4096> alloc;
+    char* a = static_cast<char*>(alloc.allocate(10, 1));
+    char* b = static_cast<char*>(alloc.allocate(8, 8));
+    assert(aligned(b, 8) && b >= a + 10 && b < a + 10 + 8);
+    char* c = static_cast<char*>(alloc.allocate(100, 64));
+    assert(aligned(c, 64));
+    for (int i = 0; i < 200; ++i) {
+        assert(aligned(alloc.allocate(100, 32), 32));
+    }
+    assert(throws_bad_alloc(alloc, 4096, 8));
+    assert(alloc.allocate(8, 8) != nullptr);
+}
+
+class alignas(64) Padded {
+ public:
+    Padded() : v(0) {}
+    explicit Padded(long v) : v(v) {}
+
+    long v;
+};
+
+// A queue takes its nodes from the allocator, with the alignment of its elements
+template <typename Allocator>
+static void test_queue() {
+    const long n = 100000;
+    SPSCQueueBase<Padded, 1, 1024, 16, Allocator> q;
+    std::thread producer([&] {
+        for (long i = 0; i < n; ++i) {
+            q.emplace(i);
+        }
+    });
+    for (long i = 0; i < n; ++i) {
+        Padded& p = q.front();
+        assert(aligned(&p, 64) && p.v == i);
+        q.pop();
+    }
+    producer.join();
+}
+
+int main() {
+    test_heap();
+    test_slab();
+    test_arena();
+    test_queue<HeapAllocator>();
+    test_queue<SlabAllocator<>>();
+    test_queue<ArenaAllocator<>>();
+    std::puts("ok");
+}
@@ -0,0 +1,110 @@
+// g++ -std=c++14 -O2 -pthread test/queue_set_test.cpp -o queue_set_test && ./queue_set_test
+
+#undef NDEBUG
+
+#include "../queue_set.hpp"
+
+#include <poll.h>
+
+#include <cassert>
+#include <cstdio>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+static void test_set_weight() {
+    QueueSet<int, 4> s;
+    bool thrown = false;
+    try {
+        s.set_weight(1, 0);
+    } catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+// Each poll() takes at most weight elements from every ready queue
+static void test_weights() {
+    QueueSet<int, 70> s;
+    s.set_weight(65, 3);
+    std::vector<std::pair<size_t, int>> got;
+    auto fn = [&](size_t idx, int& v) { got.emplace_back(idx, v); };
+    assert(s.empty());
+    assert(s.try_poll(fn) == 0);
+    for (int i = 0; i < 5; ++i) {
+        s.push(1, i);
+        s.push(65, 10 + i);
+    }
+    assert(!s.empty());
+    assert(s.try_poll(fn) == 1 + 3);
+    assert(s.try_poll(fn) == 1 + 2);
+    assert(s.try_poll(fn) == 1);
+    assert(s.try_poll(fn) == 1);
+    assert(s.try_poll(fn) == 1);
+    assert(s.try_poll(fn) == 0);
+    assert(s.empty());
+    std::vector<int> q1;
+    std::vector<int> q65;
+    for (auto& p : got) {
+        (p.first == 1 ? q1 : q65).push_back(p.second);
+    }
+    assert((q1 == std::vector<int>{0, 1, 2, 3, 4}));
+    assert((q65 == std::vector<int>{10, 11, 12, 13, 14}));
+}
+
+// Producers push to their own queues. The consumer sees every element, in order within each queue
+template <typename S, int mode>
+static void test_threads() {
+    const int num_producers = 5;
+    const size_t num_queues = 70;
+    const long n = 2000;
+    static S s;
+    s.set_weight(3, 4);
+    std::vector<long> last(num_queues, -1);
+    long total = 0;
+    std::vector<std::thread> producers;
+    for (int p = 0; p < num_producers; ++p) {
+        producers.emplace_back([p] {
+            for (long i = 0; i < n; ++i) {
+                for (size_t q = p; q < num_queues; q += num_producers) {
+                    s.push(q, i);
+                }
+            }
+        });
+    }
+    auto fn = [&](size_t idx, long& v) {
+        assert(v == last[idx] + 1);
+        last[idx] = v;
+        ++total;
+    };
+    while (total < static_cast<long>(num_queues) * n) {
+        if (mode == 5) {
+            pollfd pfd = {s.get_eventfd(), POLLIN, 0};
+            ::poll(&pfd, 1, 1000);
+            s.drain(fn);
+        } else if (mode == 0) {
+            if (s.try_poll(fn) == 0) {
+                std::this_thread::yield();
+            }
+        } else {
+            s.poll(fn);
+        }
+    }
+    for (auto& t : producers) {
+        t.join();
+    }
+    assert(s.try_poll(fn) == 0);
+}
+
+int main() {
+    test_set_weight();
+    test_weights();
+    test_threads<QueueSet<long, 70>, 0>();
+    test_threads<QueueSetSpin<long, 70>, 1>();
+    test_threads<QueueSetCV<long, 70>, 2>();
+    test_threads<QueueSetAdaptive<long, 70>, 3>();
+    test_threads<QueueSetEventFd<long, 70>, 5>();
+    test_threads<QueueSetFutex<long, 70>, 6>();
+    std::puts("ok");
+}
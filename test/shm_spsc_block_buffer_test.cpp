@@ -0,0 +1,174 @@
+// g++ -std=c++14 -O2 -pthread test/shm_spsc_block_buffer_test.cpp -o shm_spsc_block_buffer_test && ./shm_spsc_block_buffer_test
+
+#undef NDEBUG
+
+#include "../shm_spsc_block_buffer.hpp"
+
+#include <sys/wait.h>
+
+#include <cassert>
+#include <cstdio>
+#include <string>
+
+// A producer process writes ints, strings and fixed-size chunks, which a consumer process reads back
+template <typename B>
+static void test_stream(size_t block_size, size_t num_blocks, int n) {
+    B p = B::create(block_size, num_blocks, ShmRole::producer);
+    pid_t pid = fork();
+    if (pid == 0) {
+        B c = B::attach(p.fd(), ShmRole::consumer);
+        for (int i = 0; i < n; ++i) {
+            int v;
+            while (!c.get(v)) {}
+            std::string str;
+            while (!c.get_string(str)) {}
+            char buf[24];
+            while (!c.get_cont(buf, sizeof(buf))) {}
+            if (v != i || str != std::string(i % 37, 'a' + i % 26)) {
+                _exit(1);
+            }
+            for (int k = 0; k < 24; ++k) {
+                if (buf[k] != static_cast<char>(i + k)) {
+                    _exit(1);
+                }
+            }
+        }
+        _exit(0);
+    }
+    for (int i = 0; i < n; ++i) {
+        while (!p.write_cont(i)) {}
+        while (!p.write_cont(std::string(i % 37, 'a' + i % 26))) {}
+        char buf[24];
+        for (int k = 0; k < 24; ++k) {
+            buf[k] = i + k;
+        }
+        const char* start = buf;
+        while (!p.write_cont(start, start + sizeof(buf))) {}
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+// The length of a string may be visible before its bytes. get_string() must then fail without reading the length
+static void test_get_string_retry() {
+    ShmSPSCBlockBuffer p = ShmSPSCBlockBuffer::create(32, 4, ShmRole::producer);
+    ShmSPSCBlockBuffer c = ShmSPSCBlockBuffer::attach(p.fd(), ShmRole::consumer);
+    std::string str;
+    assert(!c.get_string(str));
+
+    // The bytes follow the length in the same block
+    assert(p.write_cont(static_cast<size_t>(5)));
+    assert(!c.get_string(str));
+    assert(!c.get_string(str));
+    assert(p.write_cont("hello", "hello" + 5));
+    assert(c.get_string(str) && str == "hello");
+
+    // The bytes do not fit after the length, so they go to the next block
+    std::string big(20, 'x');
+    assert(p.write_cont(big.size()));
+    assert(!c.get_string(str));
+    assert(p.write_cont(big.c_str(), big.c_str() + big.size()));
+    assert(c.get_string(str) && str == big);
+
+    assert(p.write_cont(std::string()));
+    assert(c.get_string(str) && str.empty());
+    assert(c.empty());
+}
+
+// In mode 0, writes fail while every block is in use, and clear_preserved() adds up to give blocks back
+static void test_pool_exhaustion() {
+    ShmSPSCBlockBuffer p = ShmSPSCBlockBuffer::create(16, 2, ShmRole::producer);
+    ShmSPSCBlockBuffer c = ShmSPSCBlockBuffer::attach(p.fd(), ShmRole::consumer);
+    char data[40] = {};
+    const char* x = data;
+    assert(!p.write(x, x + 40));
+    assert(p.write(x, x + 32));
+    assert(!p.write(x, x + 1));
+    assert(p.ensure_cont(1) == nullptr);
+    assert(c.read_cont(16) != nullptr);
+    assert(c.read_cont(16) != nullptr);
+    assert(c.read_cont(1) == nullptr);
+    assert(c.empty());
+    c.clear_preserved(8);
+    assert(!p.write(x, x + 1));
+    c.clear_preserved(8);
+    assert(p.write(x, x + 16));
+    assert(!p.write(x, x + 1));
+}
+
+// Named buffers, a second consumer, and copying through fds
+static void test_named_and_fds() {
+    const char* name = "/shm_spsc_block_buffer_test";
+    ShmRegion::unlink(name);
+    ShmSPSCBlockBuffer p = ShmSPSCBlockBuffer::create(name, 16, 8, ShmRole::producer);
+    ShmSPSCBlockBuffer c = ShmSPSCBlockBuffer::attach(name, ShmRole::consumer);
+    ShmRegion::unlink(name);
+    bool busy = false;
+    try {
+        ShmSPSCBlockBuffer::attach(p.fd(), ShmRole::consumer);
+    } catch (const std::system_error& e) {
+        busy = e.code().value() == EBUSY;
+    }
+    assert(busy);
+
+    int fds[2];
+    assert(pipe(fds) == 0);
+    std::string str = "hello world, this spans multiple blocks";
+    assert(p.write(str.c_str(), str.c_str() + str.size()));
+    ssize_t n = c.output_to_fd(fds[1]);
+    assert(n == static_cast<ssize_t>(str.size()));
+    assert(c.output_to_fd(fds[1]) == 0);
+    char buf[100];
+    assert(read(fds[0], buf, sizeof(buf)) == n && std::string(buf, n) == str);
+
+    assert(write(fds[1], "abcdefghijklmnopqrstuvwxyz", 26) == 26);
+    assert(p.input_from_fd(fds[0], false, 26) == 26);
+    assert(c.output_to_fd(fds[1]) == 26);
+    assert(read(fds[0], buf, sizeof(buf)) == 26 && std::string(buf, 26) == "abcdefghijklmnopqrstuvwxyz");
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// A waiting consumer gives up once the producer is dead, and a new producer can take over. A waiting producer gives
+// up once the consumer is gone
+static void test_peer_gone() {
+    ShmSPSCBlockBufferFutex c = ShmSPSCBlockBufferFutex::create(64, 4, ShmRole::consumer);
+    pid_t pid = fork();
+    if (pid == 0) {
+        ShmSPSCBlockBufferFutex p = ShmSPSCBlockBufferFutex::attach(c.fd(), ShmRole::producer);
+        p.write(42);
+        kill(getpid(), SIGKILL);
+    }
+    int v;
+    assert(c.get(v) && v == 42);
+    waitpid(pid, nullptr, 0);
+    assert(!c.get(v));
+    assert(c.peer_state() == ShmPeerState::dead);
+
+    ShmSPSCBlockBufferFutex p = ShmSPSCBlockBufferFutex::attach(c.fd(), ShmRole::producer);
+    assert(c.peer_state() == ShmPeerState::alive);
+    p.write(7);
+    assert(c.get(v) && v == 7);
+
+    c.detach();
+    assert(p.peer_state() == ShmPeerState::detached);
+    char data[64] = {};
+    const char* x = data;
+    int written = 0;
+    for (int i = 0; i < 10; ++i) {
+        written += p.write(x, x + sizeof(data));
+    }
+    assert(written < 10);
+}
+
+int main() {
+    test_stream<ShmSPSCBlockBuffer>(64, 4, 1000);
+    test_stream<ShmSPSCBlockBufferSpin>(64, 4, 1000);
+    test_stream<ShmSPSCBlockBufferFutex>(64, 4, 20000);
+    test_get_string_retry();
+    test_pool_exhaustion();
+    test_named_and_fds();
+    test_peer_gone();
+    std::puts("ok");
+}
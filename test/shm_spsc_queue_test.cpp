@@ -0,0 +1,68 @@
+// g++ -std=c++14 -O2 -pthread test/shm_spsc_queue_test.cpp -o shm_spsc_queue_test && ./shm_spsc_queue_test
+
+#undef NDEBUG
+
+#include "../shm_spsc_queue.hpp"
+
+#include <sys/wait.h>
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+// A process attached as both sides is killed at random points of push() and pop(). Attaching again must find the
+// queue consistent, with the remaining elements in order and at most one node lost by each side
+static void test_reattach_after_crash() {
+    typedef ShmSPSCQueue<long> Q;
+    const char* name = "/shm_spsc_queue_test";
+    const size_t capacity = 1024;
+    ShmRegion::unlink(name);
+    Q::create(name, capacity, ShmRole::producer).detach();
+    srand(1);
+    for (long round = 1; round <= 300; ++round) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            Q p = Q::attach(name, ShmRole::producer);
+            Q c = Q::attach(name, ShmRole::consumer);
+            long v;
+            for (long i = 0;; i += 2) {
+                p.push((round << 32) | i);
+                p.push((round << 32) | (i + 1));
+                c.pop(v);
+                c.pop(v);
+            }
+        }
+        usleep(rand() % 500);
+        kill(pid, SIGKILL);
+        int status;
+        waitpid(pid, &status, 0);
+
+        Q p = Q::attach(name, ShmRole::producer);
+        Q c = Q::attach(name, ShmRole::consumer);
+        assert(p.capacity() == capacity);
+        long last = -1;
+        long v;
+        while (c.try_pop(v)) {
+            assert(v > last);
+            last = v;
+        }
+
+        // Each side loses at most one node in a crash
+        long room = 0;
+        while (p.try_push(room)) {
+            ++room;
+        }
+        assert(room >= static_cast<long>(capacity) - 2 * round);
+        for (long i = 0; i < room; ++i) {
+            assert(c.try_pop(v) && v == i);
+        }
+        assert(!c.try_pop(v));
+    }
+    ShmRegion::unlink(name);
+}
+
+int main() {
+    test_reattach_after_crash();
+    std::puts("ok");
+}
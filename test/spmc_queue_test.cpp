@@ -0,0 +1,105 @@
+// g++ -std=c++14 -O2 -pthread test/spmc_queue_test.cpp -o spmc_queue_test && ./spmc_queue_test
+
+#undef NDEBUG
+
+#include "../spmc_queue.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+// The queue is first in first out and refuses pushes when full. Elements left behind are destroyed with it
+static void test_single_thread() {
+    SPMCQueue<std::string, 4> q;
+    std::string s;
+    assert(q.empty());
+    assert(!q.try_pop(s));
+    assert(!q.pop(s));
+    for (int round = 0; round < 3; ++round) {
+        for (int i = 0; i < 4; ++i) {
+            assert(q.push(std::to_string(i)));
+        }
+        assert(!q.emplace(3, 'x'));
+        for (int i = 0; i < 4; ++i) {
+            assert(q.try_pop(s) && s == std::to_string(i));
+        }
+        assert(q.empty());
+    }
+    q.emplace(100, 'y');
+    assert(q.pop_for(s, std::chrono::seconds(0)) && s == std::string(100, 'y'));
+    q.emplace(100, 'z');
+}
+
+static void test_timed_pop() {
+    using namespace std::chrono;
+    SPMCQueueFutex<int, 16> q;
+    int v;
+    auto start = steady_clock::now();
+    assert(!q.pop_for(v, milliseconds(20)));
+    assert(steady_clock::now() - start >= milliseconds(20));
+    q.push(1);
+    assert(q.pop_for(v, milliseconds(20)) && v == 1);
+}
+
+// Every element is taken exactly once, and each consumer sees its elements in order. The producer pauses now and
+// then, so that waiting consumers go to sleep and must be woken
+template <typename Q>
+static void test_threads() {
+    const int n = 20000;
+    const int num_consumers = 3;
+    Q q;
+    std::vector<int> taken(n, 0);
+    std::vector<std::thread> consumers;
+    for (int c = 0; c < num_consumers; ++c) {
+        consumers.emplace_back([&] {
+            int last = -1;
+            int v;
+            for (;;) {
+                if (!q.pop(v)) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                if (v < 0) {
+                    return;
+                }
+                assert(v > last);
+                last = v;
+                ++taken[v];
+            }
+        });
+    }
+    for (int i = 0; i < n; ++i) {
+        while (!q.push(i)) {
+            std::this_thread::yield();
+        }
+        if (i % 1000 == 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+    for (int c = 0; c < num_consumers; ++c) {
+        while (!q.push(-1)) {
+            std::this_thread::yield();
+        }
+    }
+    for (auto& t : consumers) {
+        t.join();
+    }
+    for (int i = 0; i < n; ++i) {
+        assert(taken[i] == 1);
+    }
+    assert(q.empty());
+}
+
+int main() {
+    test_single_thread();
+    test_timed_pop();
+    test_threads<SPMCQueue<int, 16>>();
+    test_threads<SPMCQueueSpin<int, 16>>();
+    test_threads<SPMCQueueCV<int, 16>>();
+    test_threads<SPMCQueueBase<int, 16, 3>>();
+    test_threads<SPMCQueueFutex<int, 16>>();
+    std::puts("ok");
+}
@@ -0,0 +1,175 @@
+// g++ -std=c++14 -O2 -pthread test/spsc_block_buffer_test.cpp -o spsc_block_buffer_test && ./spsc_block_buffer_test
+
+#undef NDEBUG
+
+#include "../spsc_block_buffer.hpp"
+
+#include <poll.h>
+
+#include <cassert>
+#include <cstdio>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+// Reading through get<T>() clears a few bytes at a time, which must add up to give whole blocks back to the limit
+static void test_bounded_drain_by_get() {
+    SPSCBlockBufferBase<0, 1, 0, 1, 3> buf(64);
+    buf.set_max_bytes(128);
+    long written = 0;
+    long read = 0;
+    int fails = 0;
+    for (int round = 0; round < 100; ++round) {
+        while (buf.write_cont(written)) {
+            ++written;
+        }
+        ++fails;
+        while (!buf.empty()) {
+            assert(buf.get<long>() == read);
+            ++read;
+        }
+    }
+    assert(read == written);
+    assert(fails == 100);
+    // The first round fills both blocks. Afterwards the block being read still counts, so each round fills one
+    assert(written == 16 + 99 * 8);
+}
+
+// The same with strings, which take a length and the bytes from each get_string()
+static void test_bounded_drain_by_get_string() {
+    SPSCBlockBufferBase<0, 1, 0, 1, 3> buf(64);
+    buf.set_max_bytes(128);
+    int written = 0;
+    int read = 0;
+    for (int round = 0; round < 100; ++round) {
+        while (buf.write_cont(std::to_string(written))) {
+            ++written;
+        }
+        while (!buf.empty()) {
+            assert(buf.get_string() == std::to_string(read));
+            ++read;
+        }
+    }
+    assert(read == written);
+    assert(written >= 100 * 2);
+}
+
+// With a blocking limit, the producer must keep going as the consumer drains through get<T>()
+template <typename Buf>
+static void test_bounded_threads() {
+    const long n = 20000;
+    Buf buf(64);
+    buf.set_max_bytes(256);
+    std::thread producer([&] {
+        for (long i = 0; i < n; ++i) {
+            assert(buf.write_cont(i));
+        }
+    });
+    for (long i = 0; i < n; ++i) {
+        assert(buf.template get<long>() == i);
+    }
+    producer.join();
+}
+
+// The same as above for a waiting consumer, with pauses so that it goes to sleep and must be woken
+template <typename Buf>
+static void test_threads() {
+    const int n = 50000;
+    Buf buf(64);
+    std::thread producer([&] {
+        for (int i = 0; i < n; ++i) {
+            buf.write(i);
+            if (i % 1000 == 0) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
+    });
+    for (int i = 0; i < n; ++i) {
+        assert(buf.template get<int>() == i);
+    }
+    producer.join();
+}
+
+static bool readable(int fd, int timeout_ms) {
+    pollfd pfd = {fd, POLLIN, 0};
+    return ::poll(&pfd, 1, timeout_ms) == 1;
+}
+
+// Writes are signalled once until drain() finds the buffer empty. A drain() stopped early leaves the rest for the next
+static void test_eventfd() {
+    SPSCBlockBufferEventFd buf(64);
+    assert(!readable(buf.get_eventfd(), 0));
+    for (int i = 0; i < 3; ++i) {
+        buf.write(i);
+    }
+    assert(readable(buf.get_eventfd(), 0));
+    assert(!buf.drain([&] {
+        assert(buf.get<int>() == 0);
+        return false;
+    }));
+    int next = 1;
+    assert(buf.drain([&] {
+        assert(buf.get<int>() == next++);
+        return true;
+    }));
+    assert(next == 3);
+    assert(!readable(buf.get_eventfd(), 0));
+    buf.write(3);
+    assert(readable(buf.get_eventfd(), 0));
+}
+
+static void test_eventfd_threads() {
+    const int n = 50000;
+    SPSCBlockBufferEventFd buf(64);
+    std::thread producer([&] {
+        for (int i = 0; i < n; ++i) {
+            buf.write(i);
+            if (i % 1000 == 0) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
+    });
+    int i = 0;
+    while (i < n) {
+        assert(readable(buf.get_eventfd(), 5000));
+        assert(buf.drain([&] {
+            assert(buf.get<int>() == i);
+            ++i;
+            return true;
+        }));
+    }
+    producer.join();
+}
+
+static_assert(std::is_same<SPSCBlockBufferFutex, BasicSPSCBlockBuffer<FutexWait>>::value, "");
+static_assert(std::is_same<SPSCBlockBufferBase<3, 1, 0, 8, 2>,
+                           BasicSPSCBlockBuffer<SpinCVWait<8>, NoNotify, Bounded<FutexWait>>>::value, "");
+
+// A combination no mode offers: the consumer blocks by futex and the producer spins for room
+static void test_policies() {
+    const long n = 20000;
+    BasicSPSCBlockBuffer<FutexWait, NoNotify, Bounded<SpinWait>> buf(64);
+    buf.set_max_bytes(128);
+    std::thread producer([&] {
+        for (long i = 0; i < n; ++i) {
+            assert(buf.write_cont(i));
+        }
+    });
+    for (long i = 0; i < n; ++i) {
+        assert(buf.get<long>() == i);
+    }
+    producer.join();
+}
+
+int main() {
+    test_bounded_drain_by_get();
+    test_bounded_drain_by_get_string();
+    test_bounded_threads<SPSCBlockBufferBase<1, 1, 0, 1, 1>>();
+    test_bounded_threads<SPSCBlockBufferBase<1, 1, 0, 1, 2>>();
+    test_threads<SPSCBlockBufferFutex>();
+    test_eventfd();
+    test_eventfd_threads();
+    test_policies();
+    std::puts("ok");
+}
@@ -0,0 +1,518 @@
+// g++ -std=c++14 -O2 -pthread test/spsc_queue_test.cpp -o spsc_queue_test && ./spsc_queue_test
+
+#undef NDEBUG
+
+#include "../spsc_queue.hpp"
+
+#include <poll.h>
+
+#include <cassert>
+#include <cstdio>
+#include <chrono>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+static void test_batch() {
+    SPSCQueue<std::string> q;
+    std::vector<std::string> items = {"a", "b", "c", "d"};
+    assert(q.push_range(items.begin(), items.end()) == 4);
+    assert(q.emplace_n(3, 2, 'x') == 3);
+
+    std::vector<std::string> out;
+    assert(q.pop_n(std::back_inserter(out), 3) == 3);
+    assert((out == std::vector<std::string>{"a", "b", "c"}));
+    out.clear();
+    assert(q.pop_n(std::back_inserter(out), 100) == 4);
+    assert((out == std::vector<std::string>{"d", "xx", "xx", "xx"}));
+    assert(q.empty());
+
+    assert(q.push_range(items.begin(), items.begin()) == 0);
+    assert(q.pop_n(std::back_inserter(out), 10) == 0);
+    assert(q.consume_all([](std::string&) { assert(false); }) == 0);
+
+    q.push_range(items.begin(), items.end());
+    std::string joined;
+    assert(q.consume_all([&](std::string& s) { joined += s; }) == 4);
+    assert(joined == "abcd");
+    assert(q.empty());
+}
+
+// Batches from the producer arrive whole and in order, whatever size the consumer takes them in
+static void test_batch_threads() {
+    const int n = 100000;
+    SPSCQueueSpin<int> q;
+    std::thread producer([&] {
+        std::vector<int> batch;
+        for (int i = 0; i < n; i += 10) {
+            batch.clear();
+            for (int k = i; k < i + 10; ++k) {
+                batch.push_back(k);
+            }
+            q.push_range(batch.begin(), batch.end());
+        }
+    });
+    int next = 0;
+    int out[7];
+    while (next < n) {
+        size_t got = q.pop_n(out, 7);
+        for (size_t k = 0; k < got; ++k) {
+            assert(out[k] == next++);
+        }
+        if (next < n) {
+            q.consume_all([&](int& v) { assert(v == next++); });
+        }
+    }
+    producer.join();
+    assert(q.empty());
+}
+
+// Every element arrives in order. The producer pauses now and then, so that a waiting consumer goes to sleep and must
+// be woken
+template <typename Q>
+static void test_threads() {
+    const int n = 50000;
+    Q q;
+    std::thread producer([&] {
+        for (int i = 0; i < n; ++i) {
+            q.push(std::to_string(i));
+            if (i % 1000 == 0) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
+    });
+    for (int i = 0; i < n; ++i) {
+        assert(q.front() == std::to_string(i));
+        q.pop();
+    }
+    producer.join();
+    assert(q.empty());
+}
+
+static bool readable(int fd, int timeout_ms) {
+    pollfd pfd = {fd, POLLIN, 0};
+    return ::poll(&pfd, 1, timeout_ms) == 1;
+}
+
+// get_eventfd() is readable exactly while there is something to drain()
+static void test_eventfd() {
+    SPSCQueueEventFd<std::string> q;
+    assert(!readable(q.get_eventfd(), 0));
+    q.push("a");
+    q.push("b");
+    assert(readable(q.get_eventfd(), 0));
+    std::string got;
+    assert(q.drain([&](std::string& s) { got += s; }) == 2);
+    assert(got == "ab");
+    assert(!readable(q.get_eventfd(), 0));
+    assert(q.drain([](std::string&) { assert(false); }) == 0);
+    q.push("c");
+    assert(readable(q.get_eventfd(), 0));
+}
+
+static void test_eventfd_threads() {
+    const int n = 50000;
+    SPSCQueueEventFd<std::string> q;
+    std::thread producer([&] {
+        for (int i = 0; i < n; ++i) {
+            q.push(std::to_string(i));
+            if (i % 1000 == 0) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
+    });
+    int i = 0;
+    while (i < n) {
+        assert(readable(q.get_eventfd(), 5000));
+        q.drain([&](std::string& s) {
+            assert(s == std::to_string(i));
+            ++i;
+        });
+    }
+    producer.join();
+    assert(q.empty());
+}
+
+// The non-waiting pops fail on an empty queue, and the timed ones fail no earlier than the deadline. A consumer that
+// keeps timing out still gets every element in order
+template <typename Q>
+static void test_timed_pop() {
+    using namespace std::chrono;
+    Q q;
+    std::string s;
+    assert(q.try_front() == nullptr);
+    assert(!q.try_pop(s));
+    auto start = steady_clock::now();
+    assert(!q.pop_for(s, milliseconds(20)));
+    assert(steady_clock::now() - start >= milliseconds(20));
+    auto deadline = system_clock::now() + milliseconds(10);
+    assert(!q.pop_until(s, deadline));
+    assert(system_clock::now() >= deadline);
+
+    q.push("a");
+    q.push("b");
+    assert(*q.try_front() == "a");
+    assert(q.try_pop(s) && s == "a");
+    assert(q.pop_for(s, seconds(0)) && s == "b");
+    assert(q.empty());
+
+    const int n = 20000;
+    std::thread producer([&] {
+        for (int i = 0; i < n; ++i) {
+            q.push(std::to_string(i));
+            if (i % 1000 == 0) {
+                std::this_thread::sleep_for(milliseconds(2));
+            }
+        }
+    });
+    int i = 0;
+    while (i < n) {
+        if (q.pop_for(s, microseconds(500))) {
+            assert(s == std::to_string(i));
+            ++i;
+        }
+    }
+    producer.join();
+}
+
+class Msg {
+ public:
+    long id;
+    char payload[1000];
+};
+
+// A claimed element is filled in place and stays hidden from the consumer until commit()
+static void test_claim() {
+    SPSCQueue<Msg> q;
+    Msg* m = q.claim();
+    m->id = 1;
+    assert(q.empty());
+    q.commit();
+    assert(!q.empty() && q.front().id == 1);
+    q.pop();
+
+    const int n = 20000;
+    SPSCQueueFutex<Msg> tq;
+    std::thread producer([&] {
+        for (int i = 0; i < n; ++i) {
+            Msg* msg = tq.claim();
+            msg->id = i;
+            msg->payload[999] = static_cast<char>(i);
+            tq.commit();
+        }
+    });
+    for (int i = 0; i < n; ++i) {
+        assert(tq.front().id == i && tq.front().payload[999] == static_cast<char>(i));
+        tq.pop();
+    }
+    producer.join();
+}
+
+// A view holds what was there at peek(), and release() pops a prefix of it
+static void test_peek() {
+    SPSCQueue<std::string> q;
+    assert(q.peek().empty());
+    q.push("a");
+    q.push("b");
+    q.push("c");
+    auto view = q.peek();
+    q.push("d");
+    std::string got;
+    for (auto& s : view) {
+        got += s;
+    }
+    assert(got == "abc");
+    q.release(0);
+    q.release(2);
+    assert(q.front() == "c");
+    view = q.peek();
+    assert(std::distance(view.begin(), view.end()) == 2);
+    q.release(2);
+    assert(q.empty() && q.peek().empty());
+}
+
+// The consumer takes elements in place, at most 7 at a time
+static void test_peek_threads() {
+    const int n = 20000;
+    SPSCQueue<std::string> q;
+    std::thread producer([&] {
+        for (int i = 0; i < n; ++i) {
+            q.push(std::to_string(i));
+            if (i % 100 == 0) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    int i = 0;
+    while (i < n) {
+        size_t taken = 0;
+        for (auto& s : q.peek()) {
+            assert(s == std::to_string(i + taken));
+            if (++taken == 7) {
+                break;
+            }
+        }
+        q.release(taken);
+        i += taken;
+    }
+    producer.join();
+    assert(q.empty());
+}
+
+// Counts the nodes a queue holds
+class CountingAllocator : public HeapAllocator {
+ public:
+    inline void* allocate(size_t size, size_t align) {
+        __atomic_add_fetch(&live, 1, __ATOMIC_RELAXED);
+        return HeapAllocator::allocate(size, align);
+    }
+
+    inline void deallocate(void* ptr, size_t size, size_t align) {
+        __atomic_sub_fetch(&live, 1, __ATOMIC_RELAXED);
+        HeapAllocator::deallocate(ptr, size, align);
+    }
+
+    static long live;
+};
+
+long CountingAllocator::live = 0;
+
+// After a burst, shrink_to() gives back the free nodes, and set_max_free() keeps the free list from growing again
+static void test_trim() {
+    {
+        SPSCQueueBase<long, 0, 1024, 16, CountingAllocator> q;
+        const long n = 100000;
+        for (long i = 0; i < n; ++i) {
+            q.push(i);
+        }
+        for (long i = 0; i < n; ++i) {
+            assert(q.front() == i);
+            q.pop();
+        }
+        assert(CountingAllocator::live > n);
+        q.shrink_to(10);
+        assert(CountingAllocator::live <= 12);
+
+        q.set_max_free(100);
+        for (long i = 0; i < n; ++i) {
+            q.push(i);
+        }
+        for (long i = 0; i < n; ++i) {
+            q.pop();
+        }
+        q.push(1);
+        assert(CountingAllocator::live <= 104);
+    }
+    assert(CountingAllocator::live == 0);
+
+    // The producer trims while the consumer is recycling nodes
+    {
+        const long n = 200000;
+        SPSCQueueBase<long, 6, 1024, 16, CountingAllocator> q;
+        q.set_max_free(64);
+        std::thread consumer([&] {
+            for (long i = 0; i < n; ++i) {
+                assert(q.front() == i);
+                q.pop();
+            }
+        });
+        for (long i = 0; i < n; ++i) {
+            q.push(i);
+            if (i % 10000 == 0) {
+                q.shrink_to(i % 3);
+            }
+        }
+        consumer.join();
+    }
+    assert(CountingAllocator::live == 0);
+}
+
+// With limit_policy 3 every way of pushing fails once set_limit() elements are in the queue, until the consumer pops
+static void test_bounded() {
+    SPSCQueueBase<long, 0, 1024, 16, HeapAllocator, 3> q;
+    q.set_limit(4);
+    assert(!q.full());
+    long items[] = {0, 1, 2, 3, 4, 5};
+    assert(q.push_range(items, items + 3) == 3);
+    assert(q.push(3));
+    assert(q.full());
+    assert(!q.push(4));
+    assert(!q.emplace(4));
+    assert(!q.try_push(4));
+    assert(!q.try_emplace(4));
+    assert(q.claim() == nullptr);
+    assert(q.push_range(items + 4, items + 6) == 0);
+    assert(q.emplace_n(2, 4) == 0);
+
+    long v;
+    assert(q.try_pop(v) && v == 0);
+    assert(q.try_pop(v) && v == 1);
+    assert(q.push_range(items + 4, items + 6) == 2);
+    assert(q.full());
+    for (long i = 2; i < 6; ++i) {
+        assert(q.try_pop(v) && v == i);
+    }
+    assert(q.empty() && !q.full());
+
+    // Unbounded ignores the limit
+    SPSCQueue<long> u;
+    u.set_limit(1);
+    assert(u.push(0) && u.push(1) && !u.full());
+}
+
+// A producer against a slow consumer. Blocking policies never fail, and nothing is lost or reordered
+template <typename Q>
+static void test_bounded_threads(bool may_fail) {
+    const long n = 100000;
+    Q q;
+    q.set_limit(100);
+    std::thread consumer([&] {
+        for (long i = 0; i < n; ++i) {
+            assert(q.front() == i);
+            q.pop();
+            if (i % 5000 == 0) {
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        }
+    });
+    long batch[7];
+    for (long i = 0; i < n;) {
+        if (i % 3 == 0 && i + 7 <= n) {
+            for (long k = 0; k < 7; ++k) {
+                batch[k] = i + k;
+            }
+            size_t pushed = q.push_range(batch, batch + 7);
+            assert(may_fail || pushed == 7);
+            i += pushed;
+        } else if (q.push(i)) {
+            ++i;
+        } else {
+            assert(may_fail);
+            std::this_thread::yield();
+        }
+    }
+    consumer.join();
+}
+
+// Not default-constructible, and counts the live instances
+class Tracked {
+ public:
+    explicit Tracked(long v) : v(v) {
+        ++live;
+    }
+
+    Tracked(const Tracked& other) : v(other.v) {
+        ++live;
+    }
+
+    Tracked& operator=(const Tracked& other) {
+        v = other.v;
+        return *this;
+    }
+
+    ~Tracked() {
+        --live;
+    }
+
+    long v;
+    static long live;
+};
+
+long Tracked::live = 0;
+
+// Every way of popping destroys the element at once, free nodes hold no element, and the queue destroys what is left,
+// including a claimed but uncommitted element
+static void test_lifetime() {
+    {
+        SPSCQueue<Tracked> q;
+        assert(Tracked::live == 0);
+        for (long i = 0; i < 10; ++i) {
+            q.emplace(i);
+        }
+        assert(Tracked::live == 10);
+        q.pop();
+        assert(Tracked::live == 9);
+        Tracked t(0);
+        assert(q.try_pop(t) && t.v == 1);
+        assert(Tracked::live == 9);
+        std::vector<Tracked> out;
+        assert(q.pop_n(std::back_inserter(out), 2) == 2);
+        assert(Tracked::live == 9);
+        out.clear();
+        q.consume_all([](Tracked&) {});
+        assert(Tracked::live == 1);
+        for (long i = 0; i < 5; ++i) {
+            q.emplace(i);
+        }
+        q.release(2);
+        assert(Tracked::live == 4);
+        q.shrink_to(0);
+        assert(Tracked::live == 4);
+    }
+    assert(Tracked::live == 0);
+
+    SPSCQueue<std::string> q;
+    *q.claim() = "hello";
+    q.commit();
+    assert(q.back() == "hello");
+    *q.claim() = std::string(100, 'x');
+}
+
+// The mode aliases are plain policy combinations
+static_assert(std::is_same<SPSCQueueFutex<long>, BasicSPSCQueue<long, FutexWait>>::value, "");
+static_assert(std::is_same<SPSCQueueEventFd<long>, BasicSPSCQueue<long, NoWait, EventFdNotify>>::value, "");
+static_assert(std::is_same<SPSCQueueBase<long, 2, 1024, 16, HeapAllocator, 3>,
+                           BasicSPSCQueue<long, CVWait, NoNotify, HeapAllocator, Bounded<NoWait>>>::value, "");
+
+// A combination no mode offers: the consumer blocks by futex, the queue also signals an eventfd, and the producer
+// waits by futex for room
+static void test_policies() {
+    const int n = 20000;
+    BasicSPSCQueue<std::string, FutexWait, EventFdNotify, HeapAllocator, Bounded<FutexWait>> q;
+    q.set_limit(16);
+    assert(!readable(q.get_eventfd(), 0));
+    std::thread producer([&] {
+        for (int i = 0; i < n; ++i) {
+            q.push(std::to_string(i));
+        }
+    });
+    assert(readable(q.get_eventfd(), 5000));
+    for (int i = 0; i < n; ++i) {
+        assert(q.front() == std::to_string(i));
+        q.pop();
+    }
+    producer.join();
+    assert(q.empty());
+}
+
+int main() {
+    test_batch();
+    test_batch_threads();
+    test_threads<SPSCQueueFutex<std::string>>();
+    test_threads<SPSCQueueAdaptive<std::string>>();
+    // Straight to sleep, and through a few spins and yields first
+    test_threads<SPSCQueueAdaptive<std::string, 0, 0>>();
+    test_threads<SPSCQueueAdaptive<std::string, 10, 2>>();
+    test_eventfd();
+    test_eventfd_threads();
+    test_timed_pop<SPSCQueue<std::string>>();
+    test_timed_pop<SPSCQueueSpin<std::string>>();
+    test_timed_pop<SPSCQueueCV<std::string>>();
+    test_timed_pop<SPSCQueueAdaptive<std::string>>();
+    test_timed_pop<SPSCQueueEventFd<std::string>>();
+    test_timed_pop<SPSCQueueFutex<std::string>>();
+    test_claim();
+    test_peek();
+    test_peek_threads();
+    test_trim();
+    test_bounded();
+    test_bounded_threads<SPSCQueueBase<long, 6, 1024, 16, HeapAllocator, 1>>(false);
+    test_bounded_threads<SPSCQueueBase<long, 6, 1024, 16, HeapAllocator, 2>>(false);
+    test_bounded_threads<SPSCQueueBase<long, 1, 1024, 16, HeapAllocator, 2>>(false);
+    test_bounded_threads<SPSCQueueBase<long, 6, 1024, 16, HeapAllocator, 3>>(true);
+    test_lifetime();
+    test_policies();
+    std::puts("ok");
+}
@@ -0,0 +1,58 @@
+// g++ -std=c++14 -O2 -pthread test/spsc_ring_queue_test.cpp -o spsc_ring_queue_test && ./spsc_ring_queue_test
+
+#undef NDEBUG
+
+#include "../spsc_ring_queue.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <thread>
+
+// In mode 0, pop() does not refresh the consumer's cached tail, so empty() must not trust it once head has passed it
+static void test_empty_after_pop() {
+    SPSCRingQueue<int, 4> q;
+    assert(q.empty());
+    q.push(1);
+    q.push(2);
+    q.pop();
+    q.pop();
+    assert(q.empty());
+
+    // Wrap around a few times, draining through front() and pop()
+    for (int round = 0; round < 3; ++round) {
+        for (int i = 0; i < 4; ++i) {
+            assert(q.push(i));
+        }
+        assert(q.full());
+        assert(!q.push(4));
+        for (int i = 0; i < 4; ++i) {
+            assert(q.front() == i);
+            q.pop();
+        }
+        assert(q.empty());
+        assert(!q.full());
+    }
+}
+
+static void test_threads() {
+    const int n = 100000;
+    SPSCRingQueue<int, 64> q;
+    std::thread producer([&] {
+        for (int i = 0; i < n; ++i) {
+            while (!q.push(i)) {}
+        }
+    });
+    for (int i = 0; i < n; ++i) {
+        while (q.empty()) {}
+        assert(q.front() == i);
+        q.pop();
+    }
+    producer.join();
+    assert(q.empty());
+}
+
+int main() {
+    test_empty_after_pop();
+    test_threads();
+    std::puts("ok");
+}
@@ -0,0 +1,57 @@
+// g++ -std=c++14 -O2 -pthread test/spsc_segment_queue_test.cpp -o spsc_segment_queue_test && ./spsc_segment_queue_test
+
+#undef NDEBUG
+
+#include "../spsc_segment_queue.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <thread>
+
+// In mode 0, pop() does not refresh the consumer's cached tail, so empty() must not trust it once head has passed it
+template <typename Q>
+static void test_empty_after_pop() {
+    Q q;
+    assert(q.empty());
+    q.push(1);
+    q.push(2);
+    q.pop();
+    q.pop();
+    assert(q.empty());
+
+    // Cross a few segments, draining through front() and pop()
+    for (int round = 0; round < 3; ++round) {
+        for (int i = 0; i < 100; ++i) {
+            q.push(i);
+        }
+        for (int i = 0; i < 100; ++i) {
+            assert(q.front() == i);
+            q.pop();
+        }
+        assert(q.empty());
+    }
+}
+
+static void test_threads() {
+    const int n = 100000;
+    SPSCSegmentQueue<int, 16> q;
+    std::thread producer([&] {
+        for (int i = 0; i < n; ++i) {
+            q.push(i);
+        }
+    });
+    for (int i = 0; i < n; ++i) {
+        while (q.empty()) {}
+        assert(q.front() == i);
+        q.pop();
+    }
+    producer.join();
+    assert(q.empty());
+}
+
+int main() {
+    test_empty_after_pop<SPSCSegmentQueue<int, 16>>();
+    test_empty_after_pop<SPSCQueueAuto<int, 0>>();
+    test_threads();
+    std::puts("ok");
+}
@@ -0,0 +1,104 @@
+// g++ -std=c++14 -O2 -pthread test/work_stealing_deque_test.cpp -o work_stealing_deque_test && ./work_stealing_deque_test
+
+#undef NDEBUG
+
+#include "../work_stealing_deque.hpp"
+
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// Trivially copyable and 8 bytes, but not default-constructible
+class Task {
+ public:
+    explicit Task(long id) : id(id) {}
+
+    long id;
+};
+
+static void test_init_capacity() {
+    for (size_t capacity : {0, 3, 6, 1000}) {
+        bool thrown = false;
+        try {
+            WorkStealingDeque<long> d(capacity);
+        } catch (const std::invalid_argument&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+    WorkStealingDeque<long> d(1);
+    d.push(1);
+    long v;
+    assert(d.pop(v) && v == 1);
+}
+
+// The owner pops the newest element and thieves steal the oldest, across a few grows
+static void test_single_thread() {
+    WorkStealingDeque<Task> d(2);
+    Task t(0);
+    assert(d.empty());
+    assert(!d.pop(t));
+    assert(!d.steal(t));
+    for (long i = 0; i < 100; ++i) {
+        d.push(Task(i));
+    }
+    assert(d.steal(t) && t.id == 0);
+    assert(d.pop(t) && t.id == 99);
+    assert(d.steal(t) && t.id == 1);
+    for (long i = 98; i >= 2; --i) {
+        assert(d.pop(t) && t.id == i);
+    }
+    assert(d.empty());
+    assert(!d.pop(t));
+}
+
+// Every pushed element is taken exactly once, by the owner or a thief
+static void test_threads() {
+    const long n = 200000;
+    WorkStealingDeque<long> d(4);
+    std::vector<std::atomic<int>> taken(n);
+    for (auto& x : taken) {
+        x = 0;
+    }
+    std::atomic<bool> done(false);
+    std::vector<std::thread> thieves;
+    for (int k = 0; k < 3; ++k) {
+        thieves.emplace_back([&] {
+            long v;
+            while (!done || !d.empty()) {
+                if (d.steal(v)) {
+                    ++taken[v];
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    long v;
+    for (long i = 0; i < n; ++i) {
+        d.push(i);
+        if (i % 3 == 0 && d.pop(v)) {
+            ++taken[v];
+        }
+    }
+    while (d.pop(v)) {
+        ++taken[v];
+    }
+    done = true;
+    for (auto& t : thieves) {
+        t.join();
+    }
+    for (long i = 0; i < n; ++i) {
+        assert(taken[i] == 1);
+    }
+}
+
+int main() {
+    test_init_capacity();
+    test_single_thread();
+    test_threads();
+    std::puts("ok");
+}
@@ -0,0 +1,187 @@
+/*
+ * Waiting primitives shared by the queues and buffers.
+ * Copyright (C) 2017  Kelvin Ng
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <sched.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include <chrono>
+#include <climits>
+
+inline int futex_wait(int* addr, int val, const struct timespec* timeout = nullptr) {
+    return syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, timeout, nullptr, 0);
+}
+
+inline int futex_wake(int* addr, int num) {
+    return syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, num, nullptr, nullptr, 0);
+}
+
+// Same as futex_wait(), but addr may be in memory shared with other processes
+inline int futex_wait_shared(int* addr, int val, const struct timespec* timeout = nullptr) {
+    return syscall(SYS_futex, addr, FUTEX_WAIT, val, timeout, nullptr, 0);
+}
+
+// Same as futex_wake(), but addr may be in memory shared with other processes
+inline int futex_wake_shared(int* addr, int num) {
+    return syscall(SYS_futex, addr, FUTEX_WAKE, num, nullptr, nullptr, 0);
+}
+
+// Hint the CPU that we are in a spin loop
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+// Check pred() with backoff: spin_num times with cpu_relax(), then yield_num times with sched_yield()
+// @return: true when pred() is satisfied, false when all stages are used up
+template <unsigned spin_num, unsigned yield_num, typename PredicateT>
+inline bool spin_wait(PredicateT pred) {
+    for (unsigned i = 0; i < spin_num; ++i) {
+        if (pred()) {
+            return true;
+        }
+        cpu_relax();
+    }
+    for (unsigned i = 0; i < yield_num; ++i) {
+        if (pred()) {
+            return true;
+        }
+        sched_yield();
+    }
+    return pred();
+}
+
+// Check pred() with cpu_relax() in between until it is satisfied or deadline is reached
+// @return: true when pred() is satisfied, false on timeout
+template <typename PredicateT, typename Clock, typename Duration>
+inline bool spin_wait_until(PredicateT pred, const std::chrono::time_point<Clock, Duration>& deadline) {
+    while (!pred()) {
+        if (Clock::now() >= deadline) {
+            return pred();
+        }
+        cpu_relax();
+    }
+    return true;
+}
+
+/*
+ * Put waiters to sleep on a futex until notified. notify() costs a fence and a load when nobody is waiting.
+ * Usage:
+ *     - Waiter: wait(pred), where pred() becomes true after the notifier publishes
+ *     - Notifier: publish with a release store, then call notify()
+ * With process_shared, the waiter may live in memory shared with other processes. A zero-filled waiter is valid, so
+ * freshly truncated shared memory needs no construction.
+ */
+
+// Some guarantees:
+// 1. waiters_ is written only by the waiters, but is read by the notifier
+// 2. epoch_ is written only by the notifier, but is read by the waiters
+// 3. A waiter re-checks pred() after announcing itself in waiters_, so either the waiter sees the published data or
+//    the notifier sees the waiter
+template <bool process_shared>
+class BasicFutexWaiter {
+ public:
+    template <typename PredicateT>
+    void wait(PredicateT pred) {
+        while (!pred()) {
+            __atomic_add_fetch(&waiters_, 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            int epoch = __atomic_load_n(&epoch_, __ATOMIC_ACQUIRE);
+            if (!pred()) {
+                park(epoch, nullptr);
+            }
+            __atomic_sub_fetch(&waiters_, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    // @return: true when pred() is satisfied, false on timeout
+    template <typename PredicateT, typename Clock, typename Duration>
+    bool wait_until(PredicateT pred, const std::chrono::time_point<Clock, Duration>& deadline) {
+        while (!pred()) {
+            auto now = Clock::now();
+            if (now >= deadline) {
+                return pred();
+            }
+            long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now).count();
+            struct timespec timeout;
+            timeout.tv_sec = ns / 1000000000;
+            timeout.tv_nsec = ns % 1000000000;
+
+            __atomic_add_fetch(&waiters_, 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            int epoch = __atomic_load_n(&epoch_, __ATOMIC_ACQUIRE);
+            if (!pred()) {
+                park(epoch, &timeout);
+            }
+            __atomic_sub_fetch(&waiters_, 1, __ATOMIC_RELAXED);
+        }
+        return true;
+    }
+
+    // Wake up one waiter
+    inline void notify() {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&waiters_, __ATOMIC_RELAXED) != 0) {
+            __atomic_add_fetch(&epoch_, 1, __ATOMIC_RELEASE);
+            unpark(1);
+        }
+    }
+
+    // Wake up all waiters
+    inline void notify_all() {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&waiters_, __ATOMIC_RELAXED) != 0) {
+            __atomic_add_fetch(&epoch_, 1, __ATOMIC_RELEASE);
+            unpark(INT_MAX);
+        }
+    }
+
+ private:
+    inline void park(int epoch, const struct timespec* timeout) {
+        if (process_shared) {
+            futex_wait_shared(&epoch_, epoch, timeout);
+        } else {
+            futex_wait(&epoch_, epoch, timeout);
+        }
+    }
+
+    inline void unpark(int num) {
+        if (process_shared) {
+            futex_wake_shared(&epoch_, num);
+        } else {
+            futex_wake(&epoch_, num);
+        }
+    }
+
+    int waiters_ = 0;
+    int epoch_ = 0;
+};
+
+typedef BasicFutexWaiter<false> FutexWaiter;
+typedef BasicFutexWaiter<true> SharedFutexWaiter;
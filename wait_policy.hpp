@@ -0,0 +1,403 @@
+/*
+ * Policy types which configure how the queues and buffers wait, notify and limit their size.
+ * Copyright (C) 2017  Kelvin Ng
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "wait.hpp"
+
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+
+// Fields written by different threads are kept CACHE_LINE_SIZE apart to avoid false sharing
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+/*
+ * A wait policy decides how the consumer waits and how the producer wakes it up. It needs:
+ *     - static constexpr bool blocking: false if wait() may return before pred() holds
+ *     - void notify(StoreT store): for the producer. Run store() to publish, and wake up the consumer if needed
+ *     - bool wait(PredicateT pred): for the consumer. Wait until pred() holds
+ *       @return: the last result of pred()
+ *     - bool wait_until(PredicateT pred, deadline): for the consumer. Same as wait(pred) but give up at deadline
+ *       @return: false on timeout
+ * A notify policy adds a signal to the consumer on top of the wait policy. It needs:
+ *     - void notify(): for the producer, after publishing
+ *     - int get_eventfd()
+ *     - void clear(): for the consumer, before consuming
+ *     - bool rest(PredicateT empty): for the consumer, after consuming. Mark the consumer idle
+ *       @return: true if empty() still holds, so the next notify() signals again. Otherwise the consumer is not idle
+ * A capacity policy decides whether the producer waits for the consumer to give space back. It needs:
+ *     - static constexpr bool may_fail: true if wait_room() may return false
+ *     - void set_limit(size_t n)
+ *     - void acquire(size_t n): for the producer, after taking n units of space
+ *     - bool full(const size_t* released, size_t n): for the producer. Whether n more units would exceed the limit,
+ *       where *released is the number of units the consumer has given back
+ *     - bool wait_room(PredicateT pred): for the producer. Wait until pred() holds
+ *       @return: false if the producer should fail instead
+ *     - void release(): for the consumer, after publishing *released
+ * Policies without state are empty, so they take no space as base classes.
+ */
+
+// Never wait
+class NoWait {
+ public:
+    static constexpr bool blocking = false;
+
+    template <typename StoreT>
+    inline void notify(StoreT store) {
+        store();
+    }
+
+    template <typename PredicateT>
+    inline bool wait(PredicateT pred) {
+        return pred();
+    }
+
+    // Spin with cpu_relax(), since a deadline is given
+    template <typename PredicateT, typename Clock, typename Duration>
+    inline bool wait_until(PredicateT pred, const std::chrono::time_point<Clock, Duration>& deadline) {
+        return spin_wait_until(pred, deadline);
+    }
+};
+
+// Wait by spinning
+class SpinWait {
+ public:
+    static constexpr bool blocking = true;
+
+    template <typename StoreT>
+    inline void notify(StoreT store) {
+        store();
+    }
+
+    template <typename PredicateT>
+    inline bool wait(PredicateT pred) {
+        while (!pred());
+        return true;
+    }
+
+    template <typename PredicateT, typename Clock, typename Duration>
+    inline bool wait_until(PredicateT pred, const std::chrono::time_point<Clock, Duration>& deadline) {
+        return spin_wait_until(pred, deadline);
+    }
+};
+
+// Wait by condition variable
+class CVWait {
+ public:
+    static constexpr bool blocking = true;
+
+    template <typename StoreT>
+    inline void notify(StoreT store) {
+        std::unique_lock<std::mutex> lk(mtx_);
+        // Atomic is still needed in store() because pred() is not always checked under the lock
+        store();
+        lk.unlock();
+        cv_.notify_one();
+    }
+
+    template <typename PredicateT>
+    inline bool wait(PredicateT pred) {
+        if (!pred()) {
+            std::unique_lock<std::mutex> lk(mtx_);
+            cv_.wait(lk, pred);
+        }
+        return true;
+    }
+
+    template <typename PredicateT, typename Clock, typename Duration>
+    inline bool wait_until(PredicateT pred, const std::chrono::time_point<Clock, Duration>& deadline) {
+        if (pred()) {
+            return true;
+        }
+        std::unique_lock<std::mutex> lk(mtx_);
+        return cv_.wait_until(lk, deadline, pred);
+    }
+
+ private:
+    alignas(CACHE_LINE_SIZE) std::mutex mtx_;
+    std::condition_variable cv_;
+};
+
+// Check spin_num times, then wait by condition variable
+template <unsigned spin_num>
+class SpinCVWait : public CVWait {
+ public:
+    template <typename PredicateT>
+    inline bool wait(PredicateT pred) {
+        for (unsigned i = 0; i < spin_num; ++i) {
+            if (pred()) {
+                return true;
+            }
+        }
+        return CVWait::wait(pred);
+    }
+};
+
+// Wait by condition variable with timeout_us microseconds of timeout, so the producer only needs to take the lock
+// every notify_interval notifications
+template <unsigned notify_interval, unsigned long long timeout_us>
+class CVTimeoutWait {
+ public:
+    static constexpr bool blocking = true;
+
+    template <typename StoreT>
+    inline void notify(StoreT store) {
+        ++notify_counter_;
+        if (notify_counter_ == notify_interval) {
+            notify_counter_ = 0;
+            std::unique_lock<std::mutex> lk(mtx_);
+            // Atomic is still needed in store() because pred() is not always checked under the lock
+            store();
+            lk.unlock();
+            cv_.notify_one();
+        } else {
+            store();
+        }
+    }
+
+    template <typename PredicateT>
+    inline bool wait(PredicateT pred) {
+        while (!pred()) {
+            std::unique_lock<std::mutex> lk(mtx_);
+            cv_.wait_for(lk, std::chrono::microseconds(timeout_us), pred);
+        }
+        return true;
+    }
+
+    template <typename PredicateT, typename Clock, typename Duration>
+    inline bool wait_until(PredicateT pred, const std::chrono::time_point<Clock, Duration>& deadline) {
+        while (!pred()) {
+            if (Clock::now() >= deadline) {
+                return pred();
+            }
+            std::unique_lock<std::mutex> lk(mtx_);
+            cv_.wait_for(lk, std::chrono::microseconds(timeout_us), pred);
+        }
+        return true;
+    }
+
+ private:
+    // Owned by the producer
+    unsigned notify_counter_ = 0;
+
+    alignas(CACHE_LINE_SIZE) std::mutex mtx_;
+    std::condition_variable cv_;
+};
+
+// Wait by futex. The producer only pays a fence and a load when the consumer is not sleeping
+class FutexWait {
+ public:
+    static constexpr bool blocking = true;
+
+    template <typename StoreT>
+    inline void notify(StoreT store) {
+        store();
+        futex_.notify();
+    }
+
+    template <typename PredicateT>
+    inline bool wait(PredicateT pred) {
+        futex_.wait(pred);
+        return true;
+    }
+
+    template <typename PredicateT, typename Clock, typename Duration>
+    inline bool wait_until(PredicateT pred, const std::chrono::time_point<Clock, Duration>& deadline) {
+        return futex_.wait_until(pred, deadline);
+    }
+
+ protected:
+    alignas(CACHE_LINE_SIZE) FutexWaiter futex_;
+};
+
+// Spin spin_num times with pause, then yield yield_num times, then sleep by futex
+template <unsigned spin_num, unsigned yield_num>
+class AdaptiveWait : public FutexWait {
+ public:
+    template <typename PredicateT>
+    inline bool wait(PredicateT pred) {
+        if (!spin_wait<spin_num, yield_num>(pred)) {
+            futex_.wait(pred);
+        }
+        return true;
+    }
+
+    // The spinning stages may pass the deadline
+    template <typename PredicateT, typename Clock, typename Duration>
+    inline bool wait_until(PredicateT pred, const std::chrono::time_point<Clock, Duration>& deadline) {
+        return spin_wait<spin_num, yield_num>(pred) || futex_.wait_until(pred, deadline);
+    }
+};
+
+// No signal other than the wait policy
+class NoNotify {
+ public:
+    inline void notify() {}
+
+    inline int get_eventfd() const {
+        return -1;
+    }
+
+    inline void clear() {}
+
+    template <typename PredicateT>
+    inline bool rest(PredicateT empty) {
+        return empty();
+    }
+};
+
+// Signal get_eventfd() when the consumer is idle, so that it can wait with poll() or epoll together with other fds
+// Some guarantees:
+// 1. idle_ is set only by the consumer and cleared by either side. The producer writes eventfd_ only when it clears idle_
+class EventFdNotify {
+ public:
+    EventFdNotify() : eventfd_(eventfd(0, EFD_NONBLOCK)) {}
+
+    EventFdNotify(const EventFdNotify&) = delete;
+    EventFdNotify& operator=(const EventFdNotify&) = delete;
+
+    ~EventFdNotify() {
+        close(eventfd_);
+    }
+
+    inline void notify() {
+        // Pairs with the fence in rest()
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        // Only signal on the transition from idle consumer to published data
+        if (__atomic_load_n(&idle_, __ATOMIC_RELAXED) && __atomic_exchange_n(&idle_, 0, __ATOMIC_RELAXED)) {
+            uint64_t tmp = 1;
+            ::write(eventfd_, &tmp, sizeof(tmp));
+        }
+    }
+
+    inline int get_eventfd() const {
+        return eventfd_;
+    }
+
+    inline void clear() {
+        uint64_t counter;
+        ::read(eventfd_, &counter, sizeof(counter));
+    }
+
+    template <typename PredicateT>
+    inline bool rest(PredicateT empty) {
+        __atomic_store_n(&idle_, 1, __ATOMIC_RELAXED);
+        // Pairs with the fence in notify()
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (empty()) {
+            return true;
+        }
+        __atomic_store_n(&idle_, 0, __ATOMIC_RELAXED);
+        return false;
+    }
+
+ private:
+    alignas(CACHE_LINE_SIZE) int idle_ = 1;
+    int eventfd_;
+};
+
+// No limit
+class Unbounded {
+ public:
+    static constexpr bool may_fail = false;
+
+    inline void set_limit(size_t) {}
+
+    inline void acquire(size_t) {}
+
+    inline bool full(const size_t*, size_t = 1) {
+        return false;
+    }
+
+    template <typename PredicateT>
+    inline bool wait_room(PredicateT) {
+        return true;
+    }
+
+    inline void release() {}
+};
+
+// At most set_limit() units, unlimited by default. The producer waits for room by WaitPolicy. With NoWait, it fails
+// Some guarantees:
+// 1. acquired_, released_cache_ and limit_ are read or written only by the producer
+// 2. released_cache_ is a possibly outdated *released, so acquired_ - released_cache_ is never below the units in use
+// 3. waiting_ is written only by the producer while it waits for room, but is read by both the producer and consumer.
+//    The consumer notifies WaitPolicy only when waiting_ is set
+template <typename WaitPolicy>
+class Bounded {
+ public:
+    static constexpr bool may_fail = !WaitPolicy::blocking;
+
+    inline void set_limit(size_t n) {
+        limit_ = n;
+    }
+
+    inline void acquire(size_t n) {
+        acquired_ += n;
+    }
+
+    inline bool full(const size_t* released, size_t n = 1) {
+        if (acquired_ - released_cache_ + n <= limit_) {
+            return false;
+        }
+        released_cache_ = __atomic_load_n(released, __ATOMIC_ACQUIRE);
+        return acquired_ - released_cache_ + n > limit_;
+    }
+
+    template <typename PredicateT>
+    inline bool wait_room(PredicateT pred) {
+        if (!WaitPolicy::blocking) {
+            return wait_.wait(pred);
+        }
+        __atomic_store_n(&waiting_, 1, __ATOMIC_RELAXED);
+        // Pairs with the fence in release(). Either the consumer sees waiting_, or pred() sees the room it made
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        bool res = wait_.wait(pred);
+        __atomic_store_n(&waiting_, 0, __ATOMIC_RELAXED);
+        return res;
+    }
+
+    // The consumer has published *released before, so notify() has nothing more to store
+    inline void release() {
+        if (!WaitPolicy::blocking) {
+            return;
+        }
+        // Pairs with the fence in wait_room()
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&waiting_, __ATOMIC_RELAXED)) {
+            wait_.notify([]{});
+        }
+    }
+
+ private:
+    // Owned by the producer
+    alignas(CACHE_LINE_SIZE) size_t acquired_ = 0;
+    size_t released_cache_ = 0;
+    size_t limit_ = SIZE_MAX;
+
+    alignas(CACHE_LINE_SIZE) int waiting_ = 0;
+    WaitPolicy wait_;
+};
@@ -0,0 +1,188 @@
+/*
+ * WorkStealingDeque. An infinite-size deque for task scheduling, where one owner pushes and pops and other threads steal.
+ * Copyright (C) 2017  Kelvin Ng
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "spsc_queue.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+
+/*
+ * A Chase-Lev work-stealing deque. The owner thread pushes and pops at the bottom, and any other thread steals at the
+ * top. T is read racily by thieves before their CAS decides who owns it, so T must be trivially copyable, and its size
+ * must be 1, 2, 4 or 8 bytes so that it is copied by one lock-free atomic (e.g. a task pointer). T need not be default
+ * constructible.
+ */
+
+// Some guarantees:
+// 1. The elements are [top_, bottom_) in array_, at index i & (array_->capacity - 1)
+// 2. bottom_ is written only by the owner, but is read by both the owner and thieves
+// 3. top_ is advanced only by CAS, by the owner (when taking the last element) or by thieves
+// 4. array_ is written only by the owner when growing, but is read by both the owner and thieves
+// 5. A replaced array is kept in retired_ until destruction, because a thief may still be reading it. Since the
+//    capacity doubles every time, all retired arrays together are smaller than array_
+// 6. The fields owned by the owner and the thieves are on different cache lines
+
+template <typename T>
+class WorkStealingDeque {
+    static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+    static_assert(sizeof(T) <= 8 && (sizeof(T) & (sizeof(T) - 1)) == 0, "T must be 1, 2, 4 or 8 bytes");
+
+ public:
+    // Not thread-safe
+    // Throw std::invalid_argument if init_capacity is not a power of two
+    explicit WorkStealingDeque(size_t init_capacity = 1024) : top_(0), bottom_(0), retired_(nullptr) {
+        if (init_capacity == 0 || (init_capacity & (init_capacity - 1)) != 0) {
+            throw std::invalid_argument("WorkStealingDeque: init_capacity must be a power of two");
+        }
+        array_ = Array::create(init_capacity);
+    }
+
+    // Not thread-safe
+    ~WorkStealingDeque() {
+        Array::destroy(array_);
+        while (retired_ != nullptr) {
+            Array* tmp = retired_->prev;
+            Array::destroy(retired_);
+            retired_ = tmp;
+        }
+    }
+
+    // Thread-safe for only the owner
+    void push(const T& obj) {
+        int64_t b = __atomic_load_n(&bottom_, __ATOMIC_RELAXED);
+        int64_t t = __atomic_load_n(&top_, __ATOMIC_ACQUIRE);
+        Array* array = __atomic_load_n(&array_, __ATOMIC_RELAXED);
+        if (b - t > (int64_t)array->capacity - 1) {
+            array = grow(array, t, b);
+        }
+        array->put(b, obj);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        __atomic_store_n(&bottom_, b + 1, __ATOMIC_RELAXED);
+    }
+
+    // Thread-safe for only the owner
+    // Take the most recently pushed element
+    // @return: false if the deque is empty or the last element is stolen
+    bool pop(T& obj) {
+        int64_t b = __atomic_load_n(&bottom_, __ATOMIC_RELAXED) - 1;
+        Array* array = __atomic_load_n(&array_, __ATOMIC_RELAXED);
+        __atomic_store_n(&bottom_, b, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        int64_t t = __atomic_load_n(&top_, __ATOMIC_RELAXED);
+
+        if (t > b) {
+            __atomic_store_n(&bottom_, b + 1, __ATOMIC_RELAXED);
+            return false;
+        }
+
+        obj = array->get(b);
+        if (t == b) {
+            // The last element. Race with thieves for it
+            bool won = __atomic_compare_exchange_n(&top_, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+            __atomic_store_n(&bottom_, b + 1, __ATOMIC_RELAXED);
+            return won;
+        }
+        return true;
+    }
+
+    // Thread-safe for any thread other than the owner
+    // Take the least recently pushed element
+    // @return: false if the deque is empty or another thread wins the element
+    bool steal(T& obj) {
+        int64_t t = __atomic_load_n(&top_, __ATOMIC_ACQUIRE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        int64_t b = __atomic_load_n(&bottom_, __ATOMIC_ACQUIRE);
+
+        if (t >= b) {
+            return false;
+        }
+
+        Array* array = __atomic_load_n(&array_, __ATOMIC_ACQUIRE);
+        T tmp = array->get(t);
+        if (!__atomic_compare_exchange_n(&top_, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            return false;
+        }
+        obj = tmp;
+        return true;
+    }
+
+    // Thread-safe
+    // The result may be outdated as soon as it returns
+    inline bool empty() const {
+        return __atomic_load_n(&bottom_, __ATOMIC_ACQUIRE) <= __atomic_load_n(&top_, __ATOMIC_ACQUIRE);
+    }
+
+ private:
+    // The slots follow the header in the same allocation
+    class alignas(alignof(T) > alignof(size_t) ? alignof(T) : alignof(size_t)) Array {
+     public:
+        static Array* create(size_t capacity) {
+            Array* array = static_cast<Array*>(::operator new(sizeof(Array) + sizeof(T) * capacity));
+            array->capacity = capacity;
+            array->prev = nullptr;
+            return array;
+        }
+
+        static void destroy(Array* array) {
+            ::operator delete(array);
+        }
+
+        inline T get(int64_t i) {
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type obj;
+            __atomic_load(&slots()[i & (capacity - 1)], reinterpret_cast<T*>(&obj), __ATOMIC_RELAXED);
+            return *reinterpret_cast<T*>(&obj);
+        }
+
+        inline void put(int64_t i, const T& obj) {
+            __atomic_store(&slots()[i & (capacity - 1)], const_cast<T*>(&obj), __ATOMIC_RELAXED);
+        }
+
+        size_t capacity;
+        Array* prev;
+
+     private:
+        inline T* slots() {
+            return reinterpret_cast<T*>(this + 1);
+        }
+    };
+
+    // Thread-safe for only the owner
+    Array* grow(Array* array, int64_t t, int64_t b) {
+        Array* bigger = Array::create(array->capacity * 2);
+        for (int64_t i = t; i < b; ++i) {
+            bigger->put(i, array->get(i));
+        }
+        __atomic_store_n(&array_, bigger, __ATOMIC_RELEASE);
+
+        array->prev = retired_;
+        retired_ = array;
+        return bigger;
+    }
+
+    // Shared by the owner and thieves
+    alignas(CACHE_LINE_SIZE) int64_t top_;
+
+    // Owned by the owner
+    alignas(CACHE_LINE_SIZE) int64_t bottom_;
+    Array* array_;
+    Array* retired_;
+};